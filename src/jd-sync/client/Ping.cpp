@@ -4,6 +4,7 @@
 #include <QDateTime>
 
 #include "common/Message.h"
+#include "common/Atom.h"
 
 Ping::Ping(MessageHub *hub, QObject *parent)
 	: QObject(parent), AbstractActor(hub)
@@ -34,7 +35,7 @@ void Ping::timerEvent(QTimerEvent *event)
 
 void Ping::receive(const Message &msg)
 {
-	if (msg.channel() == "client.ping" && msg.command() == "reply") {
+	if (msg.channelAtom() == Atom::ClientPing && msg.commandAtom() == Atom::Reply) {
 		m_pingPending = false;
 		m_ping = QDateTime::currentMSecsSinceEpoch() - m_lastSentAt;
 		emit pingUpdated(m_ping);
@@ -1,11 +1,14 @@
 #include "TcpClientActor.h"
 
 #include <QTcpSocket>
+#include <QJsonArray>
 
 #include <jd-util/Json.h>
 #include <jd-util/Logging.h>
 
 #include "Message.h"
+#include "common/Atom.h"
+#include "common/MessageCodec.h"
 #include "common/TcpUtils.h"
 
 static Q_LOGGING_CATEGORY(Tcp, "tablesync.tcp.client")
@@ -27,6 +30,32 @@ void TcpClientActor::setAuthentication(const QString &data)
 	}
 }
 
+void TcpClientActor::setQueueLimits(const int messages, const qint64 bytes)
+{
+	OutboundQueue::Limits limits;
+	limits.maxMessages = messages;
+	limits.maxBytes = bytes;
+	limits.policy = OutboundQueue::DropOldest;
+	m_messagesQueue.setLimits(limits);
+}
+
+void TcpClientActor::setLatencyBudget(const int msecs)
+{
+	Q_ASSERT_X(QThread::currentThread() == thread(), "TcpClientActor::setLatencyBudget", "You need to call this from the right thread (use queued signals/slots)");
+	m_latencyBudget = msecs;
+	if (m_writer) {
+		m_writer->setLatencyBudget(msecs);
+	}
+}
+void TcpClientActor::setFlushThreshold(const int bytes)
+{
+	Q_ASSERT_X(QThread::currentThread() == thread(), "TcpClientActor::setFlushThreshold", "You need to call this from the right thread (use queued signals/slots)");
+	m_flushThreshold = bytes;
+	if (m_writer) {
+		m_writer->setFlushThreshold(bytes);
+	}
+}
+
 void TcpClientActor::connectToHost()
 {
 	Q_ASSERT_X(QThread::currentThread() == thread(), "TcpClientActor::setAuthentication", "You need to call this from the right thread (use queued signals/slots)");
@@ -44,26 +73,43 @@ void TcpClientActor::disconnectFromHost()
 void TcpClientActor::sendToExternal(const Message &message)
 {
 	// we don't send errors to the server
-	if (message.command() == "error") {
+	if (message.isError()) {
 		return;
 	}
 
 	//qCDebug(Tcp) << "sending" << message.toJson();
-	const QByteArray raw = Json::toBinary(message.toJson());
 	if (m_needAuthentication && !message.isBypassingAuth()) {
-		m_messagesQueue.enqueue(raw);
+		queueMessage(message);
 	} else if (m_socket->state() == QTcpSocket::ConnectedState) {
-		TcpUtils::writePacket(m_socket, raw);
+		m_writer->write(encode(message));
 	} else if (message.isBypassingAuth()) {
-		m_noAuthMessageQueue.enqueue(raw);
+		// never uses the string table, it is only enabled while connected
+		m_noAuthMessageQueue.enqueue(MessageCodec::encode(message, m_format));
 	} else {
-		m_messagesQueue.enqueue(raw);
+		queueMessage(message);
+	}
+}
+
+void TcpClientActor::queueMessage(const Message &message)
+{
+	// only warn the first time
+	// the message is encoded once it is sent, possibly with the string table
+	const int dropped = m_messagesQueue.enqueue(message, MessageCodec::estimateSize(message, m_format));
+	if (dropped > 0 && m_messagesQueue.dropped() == dropped) {
+		qCWarning(Tcp) << "Too many messages queued while not connected, dropping the oldest";
 	}
 }
+QByteArray TcpClientActor::encode(const Message &message)
+{
+	return MessageCodec::encode(message, m_format, m_useStringTable ? &m_encodeTable : nullptr);
+}
 
 void TcpClientActor::run()
 {
 	m_socket = new QTcpSocket(this);
+	m_writer = new TcpUtils::FrameWriter(m_socket, this);
+	m_writer->setLatencyBudget(m_latencyBudget);
+	m_writer->setFlushThreshold(m_flushThreshold);
 	connectSocket();
 
 	AbstractExternalActor::run();
@@ -73,6 +119,18 @@ void TcpClientActor::socketChangedState()
 {
 	switch (m_socket->state()) {
 	case QAbstractSocket::UnconnectedState:
+		// a new connection starts out with the format every server understands
+		m_format = MessageCodec::JsonFormat;
+		m_reader.reset();
+		m_writer->clear();
+		m_writer->setCompressionThreshold(0);
+		m_encodeTable.clear();
+		m_decodeTable.clear();
+		m_useStringTable = false;
+		resetRemoteInterest();
+		m_sessionResumed = false;
+		// every connection needs to be authenticated, also one that resumes our session
+		m_needAuthentication = !m_authentication.isNull();
 		if (m_state == Connected) {
 			m_state = Reconnecting;
 			emit message(tr("Lost connection to host"));
@@ -86,6 +144,14 @@ void TcpClientActor::socketChangedState()
 		emit message(tr("Connecting to host..."));
 		break;
 	case QAbstractSocket::ConnectedState: {
+		// servers that do not know about negotiation ignore this, in which case we stay with JSON
+		QJsonObject negotiation({{"formats", QJsonArray::fromStringList(MessageCodec::formatNames())},
+								 {"features", QJsonArray({interestFeature(), sessionFeature(), compressionFeature(), stringTableFeature()})}});
+		if (!m_sessionToken.isNull()) {
+			negotiation.insert("session", m_sessionToken.toString());
+			negotiation.insert("received", double(m_received));
+		}
+		sendToExternal(Message("client.auth", "negotiate", negotiation).setFlags(Message::BypassAuth));
 		sendQueue(&m_noAuthMessageQueue);
 		if (m_needAuthentication) {
 			emit message(tr("Authenticating..."));
@@ -122,16 +188,52 @@ void TcpClientActor::socketDataReady()
 {
 	using namespace Json;
 
-	while (m_socket->bytesAvailable() > 0) {
+	m_reader.readFrom(m_socket);
+	QByteArray frame;
+	forever {
+		try {
+			if (!m_reader.next(&frame)) {
+				break;
+			}
+		} catch (Exception &e) {
+			qCWarning(Tcp) << e.cause() << ", reconnecting";
+			m_socket->abort();
+			return;
+		}
+
 		Message msg;
 		try {
-			const QJsonObject obj = ensureObject(ensureDocument(TcpUtils::readPacket(m_socket)));
-			msg = Message::fromJson(obj);
+			msg = MessageCodec::decode(frame, &m_decodeTable);
+			if (!m_sessionToken.isNull() && !isControlMessage(msg)) {
+				++m_received;
+			}
 
-			if (msg.channel() == "client.auth") {
-				if (msg.command() == "challenge") {
+			if (msg.channelAtom() == Atom::ClientAuth) {
+				if (msg.commandAtom() == Atom::Negotiated) {
+					const QJsonObject data = msg.dataObject();
+					m_format = MessageCodec::negotiate(QStringList() << ensureString(data, "format"));
+					const QVector<QString> features = ensureIsArrayOf<QString>(data, "features", QVector<QString>());
+					if (features.contains(sessionFeature())) {
+						// if the server could not continue our session it has started a new one
+						m_sessionResumed = !m_sessionToken.isNull() && ensureBoolean(data, QStringLiteral("resumed"), false);
+						m_sessionToken = ensureUuid(data, "session");
+						if (!m_sessionResumed) {
+							m_received = 0;
+						}
+					} else {
+						m_sessionToken = QUuid();
+						m_sessionResumed = false;
+					}
+					if (features.contains(compressionFeature())) {
+						m_writer->setCompressionThreshold(TcpUtils::DefaultCompressionThreshold);
+					}
+					m_useStringTable = features.contains(stringTableFeature());
+					if (features.contains(interestFeature())) {
+						announceInterest();
+					}
+				} else if (msg.commandAtom() == Atom::Challenge) {
 					emit authenticationRequired();
-				} else if (msg.command() == "response") {
+				} else if (msg.commandAtom() == Atom::Response) {
 					if (ensureBoolean(ensureObject(msg.data()), QStringLiteral("success"))) {
 						m_needAuthentication = false;
 
@@ -140,7 +242,10 @@ void TcpClientActor::socketDataReady()
 						m_state = Connected;
 						emit connected();
 						sendQueue(&m_messagesQueue);
-						send(Message("client", "reset"));
+						// a resumed session has already been sent what we missed
+						if (!m_sessionResumed) {
+							send(Message("client", "reset"));
+						}
 					} else {
 						emit authenticationRequired();
 					}
@@ -149,6 +254,12 @@ void TcpClientActor::socketDataReady()
 				receivedFromExternal(msg);
 			}
 		} catch (Exception &e) {
+			if (msg.isNull() && m_useStringTable) {
+				// the frame might have changed our table, it can not be trusted to match the server's anymore
+				qCWarning(Tcp) << e.cause() << ", reconnecting";
+				m_socket->abort();
+				return;
+			}
 			qCWarning(Tcp) << e.cause();
 		}
 	}
@@ -164,6 +275,12 @@ void TcpClientActor::connectSocket()
 void TcpClientActor::sendQueue(QQueue<QByteArray> *queue)
 {
 	while (m_socket->isOpen() && m_socket->isWritable() && !queue->isEmpty()) {
-		TcpUtils::writePacket(m_socket, queue->dequeue());
+		m_writer->write(queue->dequeue());
+	}
+}
+void TcpClientActor::sendQueue(OutboundQueue *queue)
+{
+	while (m_socket->isOpen() && m_socket->isWritable() && !queue->isEmpty()) {
+		m_writer->write(encode(queue->dequeue()));
 	}
 }
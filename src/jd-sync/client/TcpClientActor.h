@@ -2,8 +2,12 @@
 
 #include <QObject>
 #include <QQueue>
+#include <QUuid>
 
 #include "jd-sync/common/AbstractExternalActor.h"
+#include "jd-sync/common/MessageCodec.h"
+#include "jd-sync/common/OutboundQueue.h"
+#include "jd-sync/common/TcpUtils.h"
 
 class QTcpSocket;
 
@@ -23,6 +27,16 @@ public:
 	};
 	State state() const { return m_state; }
 
+	/// limits for the messages kept while not connected (or not authenticated), the oldest are
+	/// dropped once they are reached
+	void setQueueLimits(const int messages, const qint64 bytes);
+	/// largest frame accepted from the server, the connection is closed if it sends larger ones
+	void setMaxFrameSize(const int bytes) { m_reader.setMaxFrameSize(bytes); }
+	/// how long (in milliseconds) outgoing frames may be collected before they are written, and the
+	/// amount of buffered data at which they are written right away, see TcpUtils::FrameWriter
+	void setLatencyBudget(const int msecs);
+	void setFlushThreshold(const int bytes);
+
 signals:
 	void message(const QString &message);
 	void authenticationRequired();
@@ -49,12 +63,34 @@ private:
 	quint16 m_port;
 
 	State m_state = Waiting;
+	MessageCodec::Format m_format = MessageCodec::JsonFormat;
+	TcpUtils::FrameReader m_reader;
+	TcpUtils::FrameWriter *m_writer = nullptr;
+	/// kept until the writer is created in run()
+	int m_latencyBudget = 0;
+	int m_flushThreshold = TcpUtils::FrameWriter::DefaultFlushThreshold;
+	/// names we have sent and the server has sent, if the string table has been negotiated
+	MessageCodec::StringTable m_encodeTable;
+	MessageCodec::StringTable m_decodeTable;
+	bool m_useStringTable = false;
 
-	QQueue<QByteArray> m_messagesQueue, m_noAuthMessageQueue;
+	OutboundQueue m_messagesQueue;
+	QQueue<QByteArray> m_noAuthMessageQueue;
 
 	QString m_authentication;
-	bool m_needAuthentication;
+	bool m_needAuthentication = false;
+
+	/// the session given to us by the server, used to resume it after reconnecting
+	QUuid m_sessionToken;
+	/// number of non-control messages received in the session, the server continues after them
+	quint64 m_received = 0;
+	/// if the server continued the session, in which case no reset is needed
+	bool m_sessionResumed = false;
 
 	void connectSocket();
 	void sendQueue(QQueue<QByteArray> *queue);
+	void sendQueue(OutboundQueue *queue);
+	void queueMessage(const Message &message);
+	/// encodes a message that is written right away
+	QByteArray encode(const Message &message);
 };
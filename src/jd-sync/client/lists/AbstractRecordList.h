@@ -32,6 +32,10 @@ signals:
 	void added(const QUuid &id);
 	void removed(const QUuid &id);
 	void changed(const QUuid &id, const QString &property);
+	/// the signals between these belong together, views may wait for batchFinished before updating
+	/// @note batches may be nested
+	void batchStarted();
+	void batchFinished();
 
 protected:
 	AbstractRecordList *m_parent = nullptr;
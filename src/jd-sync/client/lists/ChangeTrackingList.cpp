@@ -12,6 +12,8 @@ ChangeTrackingList::ChangeTrackingList(AbstractRecordList *parentList, QObject *
 	connect(m_parent, &AbstractRecordList::added, this, &ChangeTrackingList::addedInParent);
 	connect(m_parent, &AbstractRecordList::removed, this, &ChangeTrackingList::removedInParent);
 	connect(m_parent, &AbstractRecordList::changed, this, &ChangeTrackingList::changedInParent);
+	connect(m_parent, &AbstractRecordList::batchStarted, this, &AbstractRecordList::batchStarted);
+	connect(m_parent, &AbstractRecordList::batchFinished, this, &AbstractRecordList::batchFinished);
 }
 
 QVariantHash ChangeTrackingList::get(const QUuid &id) const
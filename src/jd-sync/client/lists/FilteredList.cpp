@@ -8,6 +8,8 @@ FilteredList::FilteredList(AbstractRecordList *parentList, QObject *parent)
 	connect(m_parent, &AbstractRecordList::added, this, &FilteredList::addedInParent);
 	connect(m_parent, &AbstractRecordList::removed, this, &FilteredList::removedInParent);
 	connect(m_parent, &AbstractRecordList::changed, this, &FilteredList::changedInParent);
+	connect(m_parent, &AbstractRecordList::batchStarted, this, &AbstractRecordList::batchStarted);
+	connect(m_parent, &AbstractRecordList::batchFinished, this, &AbstractRecordList::batchFinished);
 }
 
 void FilteredList::setFilter(const Filter &filter)
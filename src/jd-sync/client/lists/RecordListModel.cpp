@@ -10,6 +10,8 @@ RecordListModel::RecordListModel(AbstractRecordList *list, QObject *parent)
 	connect(m_list, &AbstractRecordList::added, this, &RecordListModel::addedToList);
 	connect(m_list, &AbstractRecordList::removed, this, &RecordListModel::removedFromList);
 	connect(m_list, &AbstractRecordList::changed, this, &RecordListModel::changedInList);
+	connect(m_list, &AbstractRecordList::batchStarted, this, &RecordListModel::batchStarted);
+	connect(m_list, &AbstractRecordList::batchFinished, this, &RecordListModel::batchFinished);
 
 	m_ids = m_list->ids().toVector();
 }
@@ -96,14 +98,23 @@ void RecordListModel::setHeadings(const QVector<QString> &headings)
 void RecordListModel::addedToList(const QUuid &id)
 {
 	Q_ASSERT(!m_ids.contains(id));
+	if (m_batchDepth > 0) {
+		m_pendingIds.append(id);
+		return;
+	}
 	beginInsertRows(QModelIndex(), m_ids.size(), m_ids.size());
 	m_ids.append(id);
 	endInsertRows();
 }
 void RecordListModel::removedFromList(const QUuid &id)
 {
+	if (m_pendingIds.removeOne(id)) {
+		return;
+	}
 	const int row = m_ids.indexOf(id);
 	if (row != -1) {
+		// the rows of pending changes are about to move
+		flushChanges();
 		beginRemoveRows(QModelIndex(), row, row);
 		m_ids.removeAt(row);
 		endRemoveRows();
@@ -112,14 +123,54 @@ void RecordListModel::removedFromList(const QUuid &id)
 void RecordListModel::changedInList(const QUuid &id, const QString &property)
 {
 	const int row = m_ids.indexOf(id);
+	if (row == -1) {
+		// not inserted yet, which will show the current value
+		return;
+	}
 
 	for (auto it = m_mapping.constBegin(); it != m_mapping.constEnd(); ++it) {
 		if (it.value().property == property) {
-			emit dataChanged(index(row, it.key().first), index(row, it.key().first), QVector<int>() << it.key().second);
+			if (m_batchDepth > 0) {
+				m_firstChangedRow = m_firstChangedRow == -1 ? row : qMin(m_firstChangedRow, row);
+				m_lastChangedRow = qMax(m_lastChangedRow, row);
+				if (!m_changedRoles.contains(it.key().second)) {
+					m_changedRoles.append(it.key().second);
+				}
+			} else {
+				emit dataChanged(index(row, it.key().first), index(row, it.key().first), QVector<int>() << it.key().second);
+			}
 			break;
 		}
 	}
 }
+void RecordListModel::batchStarted()
+{
+	++m_batchDepth;
+}
+void RecordListModel::batchFinished()
+{
+	Q_ASSERT(m_batchDepth > 0);
+	if (--m_batchDepth > 0) {
+		return;
+	}
+	flushChanges();
+	if (!m_pendingIds.isEmpty()) {
+		beginInsertRows(QModelIndex(), m_ids.size(), m_ids.size() + m_pendingIds.size() - 1);
+		m_ids += m_pendingIds;
+		m_pendingIds.clear();
+		endInsertRows();
+	}
+}
+void RecordListModel::flushChanges()
+{
+	if (m_firstChangedRow == -1) {
+		return;
+	}
+	emit dataChanged(index(m_firstChangedRow, 0), index(m_lastChangedRow, qMax(0, m_cols - 1)), m_changedRoles);
+	m_firstChangedRow = -1;
+	m_lastChangedRow = -1;
+	m_changedRoles.clear();
+}
 
 QPair<int, Qt::ItemDataRole> RecordListModel::reverseMapping(const QString &property, const bool editable) const
 {
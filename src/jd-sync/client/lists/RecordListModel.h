@@ -36,6 +36,8 @@ private slots:
 	void addedToList(const QUuid &id);
 	void removedFromList(const QUuid &id);
 	void changedInList(const QUuid &id, const QString &property);
+	void batchStarted();
+	void batchFinished();
 
 private:
 	AbstractRecordList *m_list;
@@ -51,4 +53,12 @@ private:
 
 	QVector<QUuid> m_ids;
 	int m_cols = 0;
+
+	/// while in a batch rows are inserted and changes are announced once at the end
+	int m_batchDepth = 0;
+	QVector<QUuid> m_pendingIds;
+	int m_firstChangedRow = -1;
+	int m_lastChangedRow = -1;
+	QVector<int> m_changedRoles;
+	void flushChanges();
 };
@@ -5,8 +5,10 @@
 #include <jd-util/Util.h>
 
 #include "common/Message.h"
+#include "common/Atom.h"
 #include "common/Request.h"
 #include "common/CRUDMessages.h"
+#include "common/StringDelta.h"
 
 using namespace JD::Util;
 
@@ -44,8 +46,22 @@ struct ToJsonObjectRecord
 };
 
 SyncedList::SyncedList(MessageHub *hub, const QString &channel, const Table &table, QObject *parent)
-	: AbstractRecordList(nullptr, parent), AbstractActor(hub), m_channel(channel), m_table(table)
+	: AbstractRecordList(nullptr, parent), AbstractActor(hub), m_channel(channel), m_channelAtom(Atom::intern(channel)), m_table(table)
 {
+	QStringList names = table.columns().keys();
+	if (!names.contains("id")) {
+		names.append("id");
+	}
+	names.sort();
+	m_schema = Schema(names.toVector());
+	Schema::registerSchema(m_schema);
+	m_idOrdinal = m_schema.ordinal("id");
+	for (const QString &name : names) {
+		const Column column = table.contains(name) ? table.column(name) : Column();
+		const bool required = table.contains(name) && !(column.isNullable() || column.defaultValue().isValid()) && name != "updated_at";
+		m_fields.append(Field{name, column, required});
+	}
+
 	subscribeTo(channel);
 }
 
@@ -60,7 +76,27 @@ void SyncedList::set(const QVector<QVariantHash> &properties)
 	}
 
 	const QVector<QJsonObject> array = Functional::map(properties, ToJsonObjectRecord(m_table, false));
-	request(UpdateMessage(m_channel, m_channel, array)).send();
+	QVector<QJsonObject> deltas;
+	if (m_deltaUpdates) {
+		for (const QJsonObject &obj : array) {
+			QStringList large;
+			for (auto it = obj.constBegin(); it != obj.constEnd(); ++it) {
+				if (it.value().isString() && it.value().toString().size() >= StringDelta::MinimumSize) {
+					large.append(it.key());
+				}
+			}
+			const QUuid id = Json::ensureUuid(obj, "id");
+			deltas.append(large.isEmpty() || !m_rows.contains(id) ? obj : StringDelta::createAll(jsonValues(id, large), obj));
+		}
+	}
+	if (m_deltaUpdates && deltas != array) {
+		// the receiver might not have the version the deltas are based on, in which case it gets everything
+		request(UpdateMessage(m_channel, m_channel, deltas))
+				.error([this, array](const ErrorMessage &) { request(UpdateMessage(m_channel, m_channel, array)).send(); })
+				.send();
+	} else {
+		request(UpdateMessage(m_channel, m_channel, array)).send();
+	}
 	for (const QJsonObject &obj : array) {
 		addOrUpdate(obj);
 	}
@@ -105,7 +141,7 @@ QList<QUuid> SyncedList::ids() const
 void SyncedList::refetch()
 {
 	if (m_lastUpdated != -1) {
-		request(IndexMessage(m_channel, m_channel).setFilter(m_focusFilter).setLimit(250).setSince(m_lastUpdated)).send();
+		sendIndex(IndexMessage(m_channel, m_channel).setFilter(m_focusFilter).setLimit(250).setSince(m_lastUpdated));
 	}
 }
 void SyncedList::fetchMore()
@@ -118,7 +154,17 @@ void SyncedList::refetch(const QUuid &id)
 }
 void SyncedList::fetchOnce(const Filter &filter)
 {
-	request(IndexMessage(m_channel, m_channel).setFilter(filter).setLimit(250)).send();
+	sendIndex(IndexMessage(m_channel, m_channel).setFilter(filter).setLimit(250));
+}
+void SyncedList::sendIndex(const IndexMessage &msg)
+{
+	// the registry is bounded, what others register might have pushed ours out
+	Schema::registerSchema(m_schema);
+	IndexMessage index = msg;
+	index.setChunkSize(IndexChunkSize, IndexCredit).setColumnarReply().setSchema(m_schema, !m_schemaAnnounced);
+	m_schemaAnnounced = true;
+	// the replies reach us through our subscription to the channel
+	m_indexRequests.insert(send(index));
 }
 
 void SyncedList::setFocus(const Filter &filter)
@@ -130,19 +176,13 @@ void SyncedList::setFocus(const Filter &filter)
 
 void SyncedList::receive(const Message &msg)
 {
-	if (msg.channel() == m_channel) {
+	if (msg.channelAtom() == m_channelAtom) {
 		if (msg.isCreateReply()) {
-			for (const QJsonObject &row : msg.toCreateReply().items()) {
-				addOrUpdate(row);
-			}
+			addOrUpdate(msg.toCreateReply().items());
 		} else if (msg.isReadReply()) {
-			for (const QJsonObject &row : msg.toReadReply().items()) {
-				addOrUpdate(row);
-			}
+			addOrUpdate(msg.toReadReply().items());
 		} else if (msg.isUpdateReply()) {
-			for (const QJsonObject &row : msg.toUpdateReply().items()) {
-				addOrUpdate(row);
-			}
+			addOrUpdate(resolveDeltas(msg.toUpdateReply().items()));
 		} else if (msg.isDeleteReply()) {
 			for (const QVariant &var : msg.toDeleteReply().recordIds()) {
 				const QUuid id = var.toUuid();
@@ -152,17 +192,162 @@ void SyncedList::receive(const Message &msg)
 				}
 			}
 		} else if (msg.isIndexReply()) {
-			for (const QJsonObject &row : msg.toIndexReply().items()) {
-				addOrUpdate(row);
+			const IndexReplyMessage reply = msg.toIndexReply();
+			addOrUpdate(reply.items());
+			// names instead of ordinals mean that the other side does not know our schema (anymore)
+			if (m_indexRequests.contains(reply.replyTo()) && reply.items().isColumnar() && reply.items().schema() != m_schema.fingerprint()) {
+				m_schemaAnnounced = false;
+			}
+			// rows of a streamed reply are applied as they come, asking for more once a chunk is done
+			if (reply.isFinal()) {
+				m_indexRequests.remove(reply.replyTo());
+			} else if (m_indexRequests.contains(reply.replyTo())) {
+				send(reply.createCredit(1));
 			}
+		} else if (msg.isError()) {
+			m_indexRequests.remove(msg.replyTo());
 		}
 	}
 }
+void SyncedList::receiveBatch(const QVector<Message> &messages)
+{
+	emit batchStarted();
+	AbstractActor::receiveBatch(messages);
+	emit batchFinished();
+}
 void SyncedList::reset()
 {
+	// the other side might not be the same as before
+	m_schemaAnnounced = false;
+	// streams of the other side are gone, refetch() starts over
+	m_indexRequests.clear();
 	refetch();
 }
 
+QJsonObject SyncedList::jsonValues(const QUuid &id, const QStringList &properties) const
+{
+	const QVariantHash row = m_rows.value(id);
+	QJsonObject out;
+	for (const QString &property : properties) {
+		if (row.contains(property) && m_table.contains(property)) {
+			out.insert(property, toJson(m_table.column(property).type(), row.value(property)));
+		}
+	}
+	return out;
+}
+JsonObjectRange SyncedList::resolveDeltas(const JsonObjectRange &records)
+{
+	bool hasDeltas = false;
+	for (const QJsonObject &record : records) {
+		hasDeltas = hasDeltas || StringDelta::containsDelta(record);
+	}
+	if (!hasDeltas) {
+		return records;
+	}
+
+	QJsonArray resolved;
+	for (const QJsonObject &record : records) {
+		if (!StringDelta::containsDelta(record)) {
+			resolved.append(record);
+			continue;
+		}
+		const QUuid id = Json::ensureUuid(record, "id");
+		QStringList properties;
+		for (auto it = record.constBegin(); it != record.constEnd(); ++it) {
+			if (StringDelta::isDelta(it.value())) {
+				properties.append(it.key());
+			}
+		}
+		try {
+			if (!m_rows.contains(id)) {
+				throw Exception("Delta for unknown row");
+			}
+			resolved.append(StringDelta::resolve(jsonValues(id, properties), record));
+		} catch (Exception &) {
+			request(ReadMessage(m_channel, m_channel, id)).send();
+		}
+	}
+	return JsonObjectRange(resolved);
+}
+
+void SyncedList::addOrUpdate(const JsonObjectRange &records)
+{
+	if (records.size() > 1) {
+		emit batchStarted();
+		addOrUpdateRows(records);
+		emit batchFinished();
+	} else {
+		addOrUpdateRows(records);
+	}
+}
+void SyncedList::addOrUpdateRows(const JsonObjectRange &records)
+{
+	if (!records.isColumnar()) {
+		for (const QJsonObject &record : records) {
+			addOrUpdate(record);
+		}
+		return;
+	}
+
+	// the columns are the same for all rows, so they only need to be mapped to fields once, which
+	// is free if they were sent as ordinals of our schema
+	QVector<int> ordinals = records.schema() == m_schema.fingerprint() ? records.ordinals() : QVector<int>();
+	if (ordinals.isEmpty()) {
+		for (const QString &name : records.columns()) {
+			ordinals.append(m_schema.ordinal(name));
+		}
+	}
+	const int idColumn = ordinals.indexOf(m_idOrdinal);
+	if (idColumn == -1) {
+		throw Exception("Invalid message: missing id column");
+	}
+	QVector<int> columns;
+	QVector<const Field *> fields;
+	QVector<bool> present(m_fields.size(), false);
+	for (int i = 0; i < ordinals.size(); ++i) {
+		const int ordinal = ordinals.at(i);
+		if (ordinal != -1) {
+			present[ordinal] = true;
+			if (ordinal != m_idOrdinal || m_table.contains(m_fields.at(ordinal).name)) {
+				columns.append(i);
+				fields.append(&m_fields.at(ordinal));
+			}
+		}
+	}
+	bool complete = true;
+	for (int ordinal = 0; ordinal < m_fields.size(); ++ordinal) {
+		if (m_fields.at(ordinal).required && !present.at(ordinal)) {
+			complete = false;
+		}
+	}
+
+	for (int row = 0; row < records.size(); ++row) {
+		const QUuid id = Json::ensureUuid(records.value(row, idColumn));
+		auto it = m_rows.find(id);
+		if (it == m_rows.end()) {
+			if (!complete) {
+				request(ReadMessage(m_channel, m_channel, id)).send();
+				continue;
+			}
+			QVariantHash values;
+			values.reserve(columns.size());
+			for (int i = 0; i < columns.size(); ++i) {
+				values.insert(fields.at(i)->name, fromJson(fields.at(i)->column.type(), records.value(row, columns.at(i))));
+			}
+			m_rows.insert(id, values);
+			emit added(id);
+		} else {
+			for (int i = 0; i < columns.size(); ++i) {
+				const QString &name = fields.at(i)->name;
+				const QVariant value = fromJson(fields.at(i)->column.type(), records.value(row, columns.at(i)));
+				if (it.value().value(name) != value) {
+					it.value().insert(name, value);
+					emit changed(id, name);
+				}
+			}
+		}
+	}
+}
 void SyncedList::addOrUpdate(const QJsonObject &record)
 {
 	const QUuid id = Json::ensureUuid(record, "id");
@@ -3,6 +3,7 @@
 #include <QObject>
 #include <QAbstractListModel>
 #include <QHash>
+#include <QSet>
 #include <QPair>
 #include <QVariant>
 #include <QUuid>
@@ -11,6 +12,9 @@
 
 #include "jd-sync/common/AbstractActor.h"
 #include "jd-sync/common/Filter.h"
+#include "jd-sync/common/Schema.h"
+class IndexMessage;
+class JsonObjectRange;
 
 #include "AbstractRecordList.h"
 
@@ -39,16 +43,56 @@ public:
 
 	Table table() const { return m_table; }
 
+	/// sends changes to large text values as deltas, see StringDelta, off by default since the
+	/// receivers of the update messages need to resolve them
+	void setDeltaUpdates(const bool enabled) { m_deltaUpdates = enabled; }
+
 private:
 	void receive(const Message &msg) override;
+	void receiveBatch(const QVector<Message> &messages) override;
 	void reset() override;
 
 	QString m_channel;
+	int m_channelAtom;
 	QHash<QUuid, QVariantHash> m_rows;
 	Table m_table;
 
 	Filter m_focusFilter;
 	int m_lastUpdated = -1;
+	bool m_deltaUpdates = false;
+
+	/// index replies are streamed in chunks of this many rows, with this many chunks in flight
+	enum
+	{
+		IndexChunkSize = 100,
+		IndexCredit = 4
+	};
+	void sendIndex(const IndexMessage &msg);
+	/// ids of our index requests whose replies are still being streamed, other lists on the channel
+	/// see the chunks as well but only the list that asked gives credit for them
+	QSet<QUuid> m_indexRequests;
+
+	/// everything needed to decode a column, indexed by the ordinal of the column in m_schema
+	struct Field
+	{
+		QString name;
+		Column column;
+		/// needs to be present for a new row to be complete
+		bool required;
+	};
+	Schema m_schema;
+	QVector<Field> m_fields;
+	int m_idOrdinal;
+	/// if the columns of m_schema have been sent on the channel since the last reset, or since a reply
+	/// showed that the other side has forgotten them
+	bool m_schemaAnnounced = false;
+
+	/// the given properties of a row as they would be sent
+	QJsonObject jsonValues(const QUuid &id, const QStringList &properties) const;
+	/// replaces deltas by full values, rows for which that is not possible are read again
+	JsonObjectRange resolveDeltas(const JsonObjectRange &records);
 
 	void addOrUpdate(const QJsonObject &record);
+	void addOrUpdate(const JsonObjectRange &records);
+	void addOrUpdateRows(const JsonObjectRange &records);
 };
@@ -5,6 +5,7 @@
 #include "MessageHub.h"
 #include "Message.h"
 #include "Request.h"
+#include "Atom.h"
 
 Q_LOGGING_CATEGORY(Actor, "actor")
 
@@ -23,40 +24,90 @@ AbstractActor::~AbstractActor()
 
 void AbstractActor::subscribeTo(const QString &channel)
 {
-	m_hub->subscribeActorTo(this, channel);
-	m_channels.insert(channel);
+	const int atom = Atom::intern(channel);
+	m_hub->subscribeActorTo(this, atom);
+	m_channels.insert(atom);
 }
 void AbstractActor::unsubscribeFrom(const QString &channel)
 {
-	m_hub->unsubscribeActorFrom(this, channel);
-	m_channels.remove(channel);
+	const int atom = Atom::find(channel);
+	if (atom == Atom::Unknown) {
+		return;
+	}
+	m_hub->unsubscribeActorFrom(this, atom);
+	m_channels.remove(atom);
 }
 QSet<QString> AbstractActor::channels() const
 {
-	return m_channels;
+	QSet<QString> out;
+	for (const int channel : m_channels) {
+		out.insert(Atom::toString(channel));
+	}
+	return out;
+}
+
+void AbstractActor::receiveBatch(const QVector<Message> &messages)
+{
+	for (const Message &msg : messages) {
+		m_hub->deliver(this, msg);
+	}
 }
 
 QUuid AbstractActor::send(const Message &msg)
+{
+	Message message = msg;
+	if (prepareToSend(&message)) {
+		m_hub->messageFromActor(this, message);
+	}
+	return message.id();
+}
+void AbstractActor::sendBatch(const QVector<Message> &messages)
+{
+	QVector<Message> batch;
+	batch.reserve(messages.size());
+	for (const Message &msg : messages) {
+		Message message = msg;
+		if (prepareToSend(&message)) {
+			batch.append(message);
+		} else if (!batch.isEmpty()) {
+			// the subscriptions have changed, which the messages after this need to see
+			m_hub->messagesFromActor(this, batch);
+			batch.clear();
+		}
+	}
+	m_hub->messagesFromActor(this, batch);
+}
+bool AbstractActor::prepareToSend(Message *message)
 {
 	// AbstractThreadedActor subscribes by sending messages, intercept those here
-	if (msg.channel() == "client") {
-		if (msg.command() == "subscribe") {
-			subscribeTo(Json::ensureString(msg.dataObject(), "channel"));
-			return msg.id();
-		} else if (msg.command() == "unsubscribe") {
-			unsubscribeFrom(Json::ensureString(msg.dataObject(), "channel"));
-			return msg.id();
+	if (message->channelAtom() == Atom::Client) {
+		switch (message->commandAtom()) {
+		case Atom::Subscribe:
+			subscribeTo(Json::ensureString(message->dataObject(), "channel"));
+			return false;
+		case Atom::Unsubscribe:
+			unsubscribeFrom(Json::ensureString(message->dataObject(), "channel"));
+			return false;
+		default:
+			break;
 		}
 	}
 
-	if (!m_channels.contains(msg.channel()) && !m_channels.contains("*") && msg.channel() != "client") {
+	const bool expectsReply = expectsReplyTo(*message);
+	if (!expectsReply && !message->to() && message->channelAtom() != Atom::Client && !m_channels.contains(message->channelAtom()) && !m_channels.contains(Atom::Wildcard)) {
 		qCWarning(Messages) << "Sending a message on a channel not subscribed to. You probably don't mean to do this.";
 	}
 
-	Message message = msg;
-	message.m_from = this;
-	m_hub->messageFromActor(this, message);
-	return message.id();
+	message->m_from = this;
+	if (expectsReply) {
+		m_hub->expectReply(this, *message);
+	}
+	return true;
+}
+
+void AbstractActor::cancelReply(const QUuid &id)
+{
+	m_hub->cancelReply(this, id);
 }
 
 Request &AbstractActor::request(const Message &msg)
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <QQueue>
 #include <QString>
 #include <QSet>
+#include <QUuid>
+#include <QVector>
 #include <QLoggingCategory>
 
 #include <jd-util/Introspection.h>
@@ -19,24 +22,57 @@ public:
 
 	MessageHub *hub() const { return m_hub; }
 
+	/// replies to at most this many messages are routed directly to an actor, after that the oldest
+	/// are forgotten as if they had been cancelled
+	enum
+	{
+		MaxPendingReplies = 1024
+	};
+
 protected:
 	virtual void receive(const Message &msg) = 0;
+	/// called instead of receive() with several messages that are ready at the same time, in order
+	/// @note the default calls receive() for each, turning exceptions into error replies like the hub does
+	/// @warning overrides must not throw, they need to pass every message on to the default (or handle
+	///          exceptions per message like it does), as an exception from a batch can not be replied to
+	virtual void receiveBatch(const QVector<Message> &messages);
 	virtual void reset() {}
+	/// return true for messages sent by this actor whose replies should be routed directly to it
+	/// @note called from the MessageHub thread
+	virtual bool expectsReplyTo(const Message &msg) const { Q_UNUSED(msg); return false; }
 
 	void subscribeTo(const QString &channel);
 	void unsubscribeFrom(const QString &channel);
 	QSet<QString> channels() const;
 	QUuid send(const Message &message);
+	/// sends several messages at once, which allows the hub to hand them to receiveBatch()
+	void sendBatch(const QVector<Message> &messages);
+
+	/// stops routing replies to the given message directly to us, for example when it is resent with a new id
+	/// @note needs to be called from the MessageHub thread
+	void cancelReply(const QUuid &id);
 
 	/// convenience function that creates a request with the same hub as this actor
 	Request &request(const Message &msg);
 
+	/// if the hub should announce interest in the channels of messages we expect replies to, see expectsReplyTo
+	/// @note actors that forward requests of others (external actors) turn this off, the interest is the other side's
+	void setReplyInterest(const bool interest) { m_replyInterest = interest; }
+
 private:
 	Q_DISABLE_COPY(AbstractActor)
 
 	friend class MessageHub;
 	MessageHub *m_hub;
-	QSet<QString> m_channels;
+	/// @returns false if the message has been handled here instead of being meant for the hub
+	bool prepareToSend(Message *message);
+	/// channel atoms
+	QSet<int> m_channels;
+	/// ids of sent messages we are registered for as reply receiver, see MessageHub::expectReply
+	QSet<QUuid> m_pendingReplies;
+	/// the same ids in the order they were sent, might still contain some that have been answered
+	QQueue<QUuid> m_pendingReplyOrder;
+	bool m_replyInterest = true;
 };
 
 Q_DECLARE_LOGGING_CATEGORY(Actor)
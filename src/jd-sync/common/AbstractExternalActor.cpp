@@ -1,20 +1,179 @@
 #include "AbstractExternalActor.h"
 
+#include <QJsonArray>
+
+#include <jd-util/Json.h>
+
 #include "MessageHub.h"
 #include "Message.h"
+#include "Atom.h"
+
+static int interestAtom()
+{
+	static const int atom = Atom::intern("interest");
+	return atom;
+}
+
+/// channels used by the connection itself, these are never subject to interest filtering
+static bool isControlChannel(const Message &message)
+{
+	const int channel = message.channelAtom();
+	return channel == Atom::Client || channel == Atom::ClientPing || channel == Atom::ClientAuth || channel == Atom::Wildcard
+			|| message.channel().startsWith(QLatin1String("client."));
+}
+static bool isControlChannel(const QString &channel)
+{
+	return channel == QLatin1String("client") || channel == QLatin1String("*") || channel.startsWith(QLatin1String("client."));
+}
+
+AbstractExternalActor::AbstractExternalActor(MessageHub *h, QObject *parent, ActorScheduler *scheduler)
+	: AbstractThreadedActor(h, parent, scheduler)
+{
+	setReplyInterest(false);
+	// we are still on the hub thread here, so we can take a consistent snapshot and subscribe to
+	// the notifications about changes to it at the same time
+	m_localInterest = h->channels();
+	AbstractActor::subscribeTo("client");
+}
 
-AbstractExternalActor::AbstractExternalActor(MessageHub *h, QObject *parent)
-	: AbstractThreadedActor(h, parent) {}
+bool AbstractExternalActor::isControlMessage(const Message &message)
+{
+	return isControlChannel(message);
+}
 
 void AbstractExternalActor::received(const Message &message)
 {
 	if (message.isInternal()) {
 		return;
 	}
-	sendToExternal(message);
+	if (message.channelAtom() == Atom::Client && message.from() == nullptr) {
+		// notifications from our hub
+		if (message.commandAtom() == Atom::Subscribe) {
+			m_localInterest.insert(Atom::intern(Json::ensureString(message.dataObject(), "channel")));
+		} else if (message.commandAtom() == Atom::Unsubscribe) {
+			m_localInterest.remove(Atom::intern(Json::ensureString(message.dataObject(), "channel")));
+		}
+		// remote sides that do not know about interest only expect these from actors subscribed to everything
+		if (!m_interestNegotiated && m_followRemoteInterest) {
+			return;
+		}
+	}
+	if (shouldForward(message)) {
+		sendToExternal(message);
+	}
+	if (message.isReply() && !message.isPartialReply()) {
+		forgetRemoteRequest(message.replyTo());
+	}
+}
+void AbstractExternalActor::forgetRemoteRequest(const QUuid &id)
+{
+	m_remoteRequests.remove(id);
+	while (!m_remoteRequestOrder.isEmpty() && !m_remoteRequests.contains(m_remoteRequestOrder.head())) {
+		m_remoteRequestOrder.dequeue();
+	}
+}
+
+bool AbstractExternalActor::shouldForward(const Message &message)
+{
+	if (isReplyToRemote(message)) {
+		return true;
+	}
+	if (!m_remoteInterestKnown || message.to() == this || isControlChannel(message)) {
+		return true;
+	}
+	return m_remoteInterest.contains(message.channelAtom()) || m_remoteInterest.contains(Atom::Wildcard);
+}
+
+bool AbstractExternalActor::expectsReplyTo(const Message &message) const
+{
+	// requests from the other side always get a reply (or an error), make sure it finds its way back
+	// even if we are not subscribed to the channel
+	return !message.isReply() && (message.isCreate() || message.isRead() || message.isUpdate() || message.isDelete() || message.isIndex());
 }
 
 void AbstractExternalActor::receivedFromExternal(const Message &message)
 {
+	if (message.channelAtom() == Atom::Client) {
+		const int command = message.commandAtom();
+		if (command == Atom::Subscribe || command == Atom::Unsubscribe) {
+			QSet<int> interest = m_remoteInterest;
+			const QString channel = Json::ensureString(message.dataObject(), "channel");
+			if (command == Atom::Subscribe) {
+				insertRemoteChannel(&interest, channel);
+			} else {
+				interest.remove(Atom::find(channel));
+			}
+			setRemoteInterest(interest);
+			return;
+		} else if (command == interestAtom()) {
+			QSet<int> interest;
+			for (const QString &channel : Json::ensureIsArrayOf<QString>(message.dataObject(), "channels")) {
+				insertRemoteChannel(&interest, channel);
+			}
+			setRemoteInterest(interest);
+			m_remoteInterestKnown = true;
+			return;
+		}
+	}
+
+	if (expectsReplyTo(message)) {
+		m_remoteRequests.insert(message.id());
+		m_remoteRequestOrder.enqueue(message.id());
+		// the hub gives up on these after as many newer ones, see AbstractActor::MaxPendingReplies
+		while (m_remoteRequestOrder.size() > MaxPendingReplies) {
+			forgetRemoteRequest(m_remoteRequestOrder.dequeue());
+		}
+	}
 	send(message);
 }
+
+void AbstractExternalActor::insertRemoteChannel(QSet<int> *interest, const QString &channel)
+{
+	const int atom = Atom::internRemote(channel);
+	if (atom == Atom::Unknown) {
+		qCWarning(Actor) << "Too many channel names registered by remote sides, ignoring interest in" << channel;
+		return;
+	}
+	interest->insert(atom);
+}
+
+void AbstractExternalActor::announceInterest()
+{
+	m_interestNegotiated = true;
+	QJsonArray channels;
+	for (const int channel : m_localInterest) {
+		const QString name = Atom::toString(channel);
+		if (!isControlChannel(name)) {
+			channels.append(name);
+		}
+	}
+	sendToExternal(Message("client", "interest", QJsonObject({{"channels", channels}})));
+}
+
+void AbstractExternalActor::resetRemoteInterest()
+{
+	setRemoteInterest(QSet<int>());
+	m_remoteInterestKnown = false;
+	m_interestNegotiated = false;
+	m_remoteRequests.clear();
+	m_remoteRequestOrder.clear();
+}
+
+void AbstractExternalActor::setRemoteInterest(const QSet<int> &channels)
+{
+	if (m_followRemoteInterest) {
+		for (const int channel : channels - m_remoteInterest) {
+			const QString name = Atom::toString(channel);
+			if (!isControlChannel(name)) {
+				subscribeTo(name);
+			}
+		}
+		for (const int channel : m_remoteInterest - channels) {
+			const QString name = Atom::toString(channel);
+			if (!isControlChannel(name)) {
+				unsubscribeFrom(name);
+			}
+		}
+	}
+	m_remoteInterest = channels;
+}
@@ -1,18 +1,71 @@
 #pragma once
 
+#include <QQueue>
+#include <QSet>
+#include <QUuid>
+
 #include "AbstractThreadedActor.h"
 
+/// Base for actors that connect the hub to a remote hub
+///
+/// Both sides tell each other which channels they are interested in: a client.interest message with
+/// the full set when connecting, followed by the client.subscribe/unsubscribe notifications of the
+/// hub. Once the remote side has announced its interest, only messages on those channels (as well
+/// as control messages and replies to requests from the remote side) are forwarded to it.
 class AbstractExternalActor : public AbstractThreadedActor
 {
 	INTROSPECTION
 public:
-	AbstractExternalActor(MessageHub *h, QObject *parent = nullptr);
+	AbstractExternalActor(MessageHub *h, QObject *parent = nullptr, ActorScheduler *scheduler = ActorScheduler::global());
 	virtual ~AbstractExternalActor() {}
 
 private:
 	void received(const Message &message) override final;
+	bool expectsReplyTo(const Message &message) const override;
 
 protected:
 	void receivedFromExternal(const Message &message);
 	virtual void sendToExternal(const Message &message) = 0;
+
+	/// name of the feature to list in the negotiation if interest announcements are supported
+	static QString interestFeature() { return QStringLiteral("interest"); }
+	/// name of the feature to list in the negotiation if sessions can be resumed after a reconnect
+	static QString sessionFeature() { return QStringLiteral("session"); }
+	/// name of the feature to list in the negotiation if compressed frames are understood
+	static QString compressionFeature() { return QStringLiteral("deflate"); }
+	/// name of the feature to list in the negotiation if names may refer to a string table, see MessageCodec::StringTable
+	static QString stringTableFeature() { return QStringLiteral("strings"); }
+	/// messages used by the connection itself rather than by the actors on either side
+	static bool isControlMessage(const Message &message);
+	/// if the message is a reply to a request from the remote side, only valid in sendToExternal()
+	bool isReplyToRemote(const Message &message) const { return message.isReply() && m_remoteRequests.contains(message.replyTo()); }
+	/// to be called once both sides have agreed on exchanging interest, sends our interest to the remote side
+	void announceInterest();
+	/// if set the actor subscribes to the channels the remote side is interested in, needed unless
+	/// the actor is subscribed to everything anyway
+	void setFollowRemoteInterest(const bool follow) { m_followRemoteInterest = follow; }
+	/// forgets the interest of the remote side and whether it supports interest announcements, for
+	/// example when the connection was lost
+	void resetRemoteInterest();
+
+private:
+	/// channel atoms subscribed to in our hub
+	QSet<int> m_localInterest;
+	/// channel atoms subscribed to in the remote hub
+	QSet<int> m_remoteInterest;
+	/// until the remote side has announced its interest everything is forwarded
+	bool m_remoteInterestKnown = false;
+	bool m_followRemoteInterest = false;
+	/// if the remote side knows about interest announcements
+	bool m_interestNegotiated = false;
+	/// ids of requests received from the remote side that are still waiting for a reply
+	QSet<QUuid> m_remoteRequests;
+	/// the same ids in the order they were received, bounded like the pending replies of the hub
+	QQueue<QUuid> m_remoteRequestOrder;
+	void forgetRemoteRequest(const QUuid &id);
+
+	bool shouldForward(const Message &message);
+	void setRemoteInterest(const QSet<int> &channels);
+	/// the names come from the remote side, see Atom::internRemote
+	void insertRemoteChannel(QSet<int> *interest, const QString &channel);
 };
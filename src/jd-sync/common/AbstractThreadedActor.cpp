@@ -1,10 +1,11 @@
 #include "AbstractThreadedActor.h"
 
-#include <QEventLoop>
+#include <QTimer>
 #include <jd-util/Exception.h>
 
 #include "MessageHub.h"
 #include "Message.h"
+#include "MessageMailbox.h"
 
 class MessagePasser : public QObject
 {
@@ -15,61 +16,82 @@ public:
 	{
 	}
 
-signals:
-	void toActor(const Message &msg);
-
 public slots:
-	void fromActor(const Message &msg)
+	void drainOutbox()
 	{
-		m_actor->AbstractActor::send(msg);
+		QVector<Message> batch;
+		m_actor->m_outbox->takeAll(&batch);
+		m_actor->AbstractActor::sendBatch(batch);
 	}
 
 private:
 	AbstractThreadedActor *m_actor;
 };
 
-AbstractThreadedActor::AbstractThreadedActor(MessageHub *hub, QObject *parent)
-	: QObject(), AbstractActor(hub), m_passer(new MessagePasser(this, parent)), m_thread(new QThread(parent))
+AbstractThreadedActor::AbstractThreadedActor(MessageHub *hub, QObject *parent, ActorScheduler *scheduler)
+	: QObject(), AbstractActor(hub), m_passer(new MessagePasser(this, parent)), m_scheduler(scheduler)
 {
-	connect(m_passer, &MessagePasser::toActor, this, &AbstractThreadedActor::receivedFromPasser);
-	connect(this, &AbstractThreadedActor::sendToPasser, m_passer, &MessagePasser::fromActor);
+	// one queued call per batch of messages, not per message
+	m_inbox = std::make_unique<MessageMailbox>([this]() { QMetaObject::invokeMethod(this, "drainInbox", Qt::QueuedConnection); });
+	m_outbox = std::make_unique<MessageMailbox>([this]() { QMetaObject::invokeMethod(m_passer, "drainOutbox", Qt::QueuedConnection); });
 
-	moveToThread(m_thread);
-	connect(m_thread, &QThread::started, this, [this]()
-	{
-		run();
-		m_thread->quit();
-	});
-	connect(m_thread, &QThread::finished, m_thread, &QThread::deleteLater);
-	connect(m_thread, &QThread::destroyed, this, [this]() { m_thread = nullptr; });
-	m_thread->start();
+	if (m_scheduler) {
+		m_thread = m_scheduler->acquire();
+		moveToThread(m_thread);
+		QTimer::singleShot(0, this, [this]() { run(); });
+	} else {
+		m_thread = new QThread(parent);
+		moveToThread(m_thread);
+		connect(m_thread, &QThread::started, this, [this]() { run(); });
+		connect(m_thread, &QThread::finished, m_thread, &QThread::deleteLater);
+		connect(m_thread, &QThread::destroyed, this, [this]() { m_thread = nullptr; });
+		m_thread->start();
+	}
 }
 
 AbstractThreadedActor::~AbstractThreadedActor()
 {
-	if (m_thread) {
+	if (m_scheduler) {
+		m_scheduler->release(m_thread);
+	} else if (m_thread) {
 		m_thread->quit();
 	}
 }
 
 void AbstractThreadedActor::receive(const Message &message)
 {
-	// this will be called from the MessageHub thread, which is the same as the MessagePasser thread
-	emit m_passer->toActor(message);
+	// this will be called from the MessageHub thread
+	m_inbox->push(message);
+}
+void AbstractThreadedActor::receiveBatch(const QVector<Message> &messages)
+{
+	for (const Message &message : messages) {
+		m_inbox->push(message);
+	}
 }
 
-void AbstractThreadedActor::receivedFromPasser(const Message &message)
+void AbstractThreadedActor::drainInbox()
+{
+	QVector<Message> batch;
+	m_inbox->takeAll(&batch);
+	if (!batch.isEmpty()) {
+		receivedBatch(batch);
+	}
+}
+void AbstractThreadedActor::receivedBatch(const QVector<Message> &messages)
 {
-	try {
-		received(message);
-	} catch (Exception &e) {
-		send(message.createErrorReply(e.cause()));
+	for (const Message &message : messages) {
+		try {
+			received(message);
+		} catch (Exception &e) {
+			send(message.createErrorReply(e.cause()));
+		}
 	}
 }
 
 void AbstractThreadedActor::send(const Message &message)
 {
-	emit sendToPasser(message);
+	m_outbox->push(message);
 }
 void AbstractThreadedActor::subscribeTo(const QString &channel)
 {
@@ -82,8 +104,6 @@ void AbstractThreadedActor::unsubscribeFrom(const QString &channel)
 
 void AbstractThreadedActor::run()
 {
-	QEventLoop loop;
-	loop.exec();
 }
 
 #include "AbstractThreadedActor.moc"
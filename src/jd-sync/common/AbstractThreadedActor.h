@@ -1,34 +1,46 @@
 #pragma once
 
 #include <QThread>
+#include <memory>
 #include "AbstractActor.h"
+#include "ActorScheduler.h"
+
+class MessageMailbox;
 
 class AbstractThreadedActor : public QObject, public AbstractActor
 {
 	Q_OBJECT
 	INTROSPECTION
 public:
-	explicit AbstractThreadedActor(MessageHub *hub, QObject *parent = nullptr);
+	/// @param scheduler the pool the actor runs on, or nullptr to give the actor a thread of its own
+	explicit AbstractThreadedActor(MessageHub *hub, QObject *parent = nullptr, ActorScheduler *scheduler = ActorScheduler::global());
 	virtual ~AbstractThreadedActor();
 
 private:
 	friend class MessagePasser;
 	class MessagePasser *m_passer;
+	/// messages from the hub, consumed on the actor thread
+	std::unique_ptr<MessageMailbox> m_inbox;
+	/// messages to the hub, consumed on the hub thread by the MessagePasser
+	std::unique_ptr<MessageMailbox> m_outbox;
 	void receive(const Message &message) override final;
+	void receiveBatch(const QVector<Message> &messages) override final;
 
 private slots:
-	void receivedFromPasser(const Message &message);
-signals:
-	void sendToPasser(const Message &message);
+	void drainInbox();
 
 protected:
 	virtual void received(const Message &message) = 0;
+	/// called with everything that was in the inbox, the default calls received() for each message
+	virtual void receivedBatch(const QVector<Message> &messages);
 	void send(const Message &message);
 	void subscribeTo(const QString &channel);
 	void unsubscribeFrom(const QString &channel);
 
+	/// called once on the actor thread after the actor has been created
 	virtual void run();
 
 private:
+	ActorScheduler *m_scheduler;
 	QThread *m_thread;
 };
@@ -0,0 +1,50 @@
+#include "ActorScheduler.h"
+
+ActorScheduler::ActorScheduler(const int threads)
+{
+	const int count = qMax(1, threads);
+	m_threads.reserve(count);
+	m_load.fill(0, count);
+	for (int i = 0; i < count; ++i) {
+		QThread *thread = new QThread;
+		thread->setObjectName(QStringLiteral("ActorScheduler-%1").arg(i));
+		thread->start();
+		m_threads.append(thread);
+	}
+}
+ActorScheduler::~ActorScheduler()
+{
+	for (QThread *thread : m_threads) {
+		thread->quit();
+	}
+	for (QThread *thread : m_threads) {
+		thread->wait();
+		delete thread;
+	}
+}
+
+QThread *ActorScheduler::acquire()
+{
+	QMutexLocker locker(&m_lock);
+	int best = 0;
+	for (int i = 1; i < m_load.size(); ++i) {
+		if (m_load.at(i) < m_load.at(best)) {
+			best = i;
+		}
+	}
+	++m_load[best];
+	return m_threads.at(best);
+}
+void ActorScheduler::release(QThread *thread)
+{
+	QMutexLocker locker(&m_lock);
+	const int index = m_threads.indexOf(thread);
+	Q_ASSERT_X(index != -1, "ActorScheduler::release", "thread does not belong to this scheduler");
+	--m_load[index];
+}
+
+Q_GLOBAL_STATIC(ActorScheduler, globalScheduler)
+ActorScheduler *ActorScheduler::global()
+{
+	return globalScheduler();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QVector>
+#include <QMutex>
+#include <QThread>
+
+/// A fixed pool of worker threads that AbstractThreadedActors are multiplexed onto
+///
+/// Each actor is bound to one worker for its whole lifetime (Qt objects, sockets in particular, can
+/// not move between threads while in use), so an actor never runs on two threads at once. New
+/// actors are placed on the worker with the fewest actors.
+class ActorScheduler
+{
+public:
+	/// @param threads number of worker threads, defaults to the number of cores
+	explicit ActorScheduler(const int threads = QThread::idealThreadCount());
+	~ActorScheduler();
+
+	int threadCount() const { return m_threads.size(); }
+	QThread *thread(const int index) const { return m_threads.at(index); }
+
+	/// returns the least loaded worker thread and accounts one more actor for it. thread-safe.
+	QThread *acquire();
+	/// to be called when an actor using the given thread is destroyed. thread-safe.
+	void release(QThread *thread);
+
+	/// shared scheduler used by default for all threaded actors
+	static ActorScheduler *global();
+
+private:
+	Q_DISABLE_COPY(ActorScheduler)
+
+	QVector<QThread *> m_threads;
+	QMutex m_lock;
+	/// number of actors per thread
+	QVector<int> m_load;
+};
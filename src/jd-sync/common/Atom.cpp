@@ -0,0 +1,112 @@
+#include "Atom.h"
+
+#include <QString>
+#include <QHash>
+#include <QVector>
+#include <QReadWriteLock>
+
+namespace
+{
+class AtomTable
+{
+public:
+	explicit AtomTable()
+	{
+		// needs to be kept in the same order as Atom::Builtin
+		for (const char *string : {"", "*", "client", "client.ping", "client.auth",
+			 "subscribe", "unsubscribe", "reset", "request", "reply", "attempt", "response", "challenge",
+			 "error", "create", "read", "update", "delete", "index",
+			 "create:result", "read:result", "update:result", "delete:result", "index:result",
+			 "negotiate", "negotiated"}) {
+			insert(QString::fromLatin1(string));
+		}
+		Q_ASSERT(m_strings.size() == Atom::FirstDynamic);
+	}
+
+	int intern(const QString &string, const bool remote)
+	{
+		const int existing = find(string);
+		if (existing != Atom::Unknown) {
+			return existing;
+		}
+
+		QWriteLocker locker(&m_lock);
+		// might have been inserted while we did not hold the lock
+		const auto it = m_atoms.constFind(string);
+		if (it != m_atoms.constEnd()) {
+			return it.value();
+		}
+		if (remote) {
+			if (m_remoteCount >= Atom::MaxRemote) {
+				return Atom::Unknown;
+			}
+			++m_remoteCount;
+		}
+		return insert(string);
+	}
+	int find(const QString &string)
+	{
+		QReadLocker locker(&m_lock);
+		return m_atoms.value(string, Atom::Unknown);
+	}
+	QString toString(const int atom)
+	{
+		QReadLocker locker(&m_lock);
+		return m_strings.value(atom);
+	}
+
+private:
+	QReadWriteLock m_lock;
+	QHash<QString, int> m_atoms;
+	QVector<QString> m_strings;
+	int m_remoteCount = 0;
+
+	int insert(const QString &string)
+	{
+		const int atom = m_strings.size();
+		m_strings.append(string);
+		m_atoms.insert(string, atom);
+		return atom;
+	}
+};
+
+AtomTable &table()
+{
+	static AtomTable table;
+	return table;
+}
+}
+
+int Atom::intern(const QString &string)
+{
+	if (string.isEmpty()) {
+		return Null;
+	}
+	return table().intern(string, false);
+}
+int Atom::internRemote(const QString &string)
+{
+	if (string.isEmpty()) {
+		return Null;
+	}
+	return table().intern(string, true);
+}
+int Atom::find(const QString &string)
+{
+	if (string.isEmpty()) {
+		return Null;
+	}
+	return table().find(string);
+}
+QString Atom::toString(const int atom)
+{
+	return table().toString(atom);
+}
+bool Atom::sameName(const int atomA, const QString &a, const int atomB, const QString &b)
+{
+	if (atomA != Unknown && atomB != Unknown) {
+		return atomA == atomB;
+	}
+	// the string might have been registered after one of the messages was created
+	return a == b;
+}
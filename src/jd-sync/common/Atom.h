@@ -0,0 +1,75 @@
+#pragma once
+
+class QString;
+
+/// Process wide table of interned channel and command strings
+///
+/// Every channel and command string is mapped to a small integer when a Message is created, so that
+/// routing and the is*() checks can compare integers instead of strings. The strings used by the
+/// library itself are pre-registered with fixed values, others get a value on first local use.
+///
+/// Entries are never removed, so strings received from remote sides are only looked up, not
+/// registered: messages decoded from the wire have the Unknown atom for names nothing in this
+/// process has used, and those have to be compared by their strings (see sameName). Names remote
+/// sides subscribe to are registered through internRemote, which is bounded.
+///
+/// The values of the builtin atoms are part of the binary wire format (see MessageCodec), so new
+/// entries may only ever be appended, and only together with a new wire format version.
+namespace Atom
+{
+enum Builtin : int
+{
+	/// a string that has not been registered, see find
+	Unknown = -1,
+	Null = 0,
+
+	// channels
+	Wildcard,
+	Client,
+	ClientPing,
+	ClientAuth,
+
+	// commands
+	Subscribe,
+	Unsubscribe,
+	Reset,
+	Request,
+	Reply,
+	Attempt,
+	Response,
+	Challenge,
+	Error,
+	Create,
+	Read,
+	Update,
+	Delete,
+	Index,
+	CreateResult,
+	ReadResult,
+	UpdateResult,
+	DeleteResult,
+	IndexResult,
+	Negotiate,
+	Negotiated,
+
+	FirstDynamic
+};
+
+/// at most this many strings are registered through internRemote
+enum
+{
+	MaxRemote = 16 * 1024
+};
+
+/// returns the atom for the given string, registering it if it is not yet known. thread-safe.
+int intern(const QString &string);
+/// like intern, but returns Unknown instead of registering once MaxRemote strings have been
+/// registered this way. for names chosen by remote sides. thread-safe.
+int internRemote(const QString &string);
+/// returns the atom for the given string, or Unknown if it has not been registered. thread-safe.
+int find(const QString &string);
+/// returns the string for the given atom, or a null string if the atom is unknown. thread-safe.
+QString toString(const int atom);
+/// if two names, given as atom and string, are the same, also if either of them is Unknown
+bool sameName(const int atomA, const QString &a, const int atomB, const QString &b);
+}
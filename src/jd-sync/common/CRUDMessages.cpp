@@ -1,6 +1,172 @@
 #include "CRUDMessages.h"
 
+#include <QStringList>
+
 #include <jd-util/Json.h>
+#include <jd-util/Exception.h>
+
+namespace
+{
+QJsonObject withSchema(QJsonObject obj, const Schema &schema, const bool announce)
+{
+	obj.insert("schema", schema.fingerprint());
+	if (announce) {
+		obj.insert("schemaColumns", QJsonArray::fromStringList(schema.columns().toList()));
+	} else {
+		obj.remove("schemaColumns");
+	}
+	return obj;
+}
+}
+
+JsonObjectRange::JsonObjectRange(const QJsonArray &array)
+	: m_array(array), m_size(array.size()) {}
+JsonObjectRange::JsonObjectRange(const QVector<QString> &columns, const QVector<QJsonArray> &values, const Schema &schema)
+	: m_columns(columns), m_values(values), m_schema(schema.fingerprint()), m_size(values.isEmpty() ? 0 : values.first().size())
+{
+	Q_ASSERT_X(columns.size() == values.size(), "JsonObjectRange", "need exactly one array of values per column");
+	if (!schema.isNull()) {
+		m_ordinals.reserve(columns.size());
+		for (const QString &column : columns) {
+			m_ordinals.append(schema.ordinal(column));
+			Q_ASSERT_X(m_ordinals.last() != -1, "JsonObjectRange", "all columns need to be part of the schema");
+		}
+	}
+}
+
+QJsonObject JsonObjectRange::at(const int index) const
+{
+	if (!isColumnar()) {
+		return m_array.at(index).toObject();
+	}
+	QJsonObject object;
+	for (int column = 0; column < m_columns.size(); ++column) {
+		object.insert(m_columns.at(column), m_values.at(column).at(index));
+	}
+	return object;
+}
+
+QJsonArray JsonObjectRange::array() const
+{
+	if (!isColumnar()) {
+		return m_array;
+	}
+	QJsonArray array;
+	for (int i = 0; i < m_size; ++i) {
+		array.append(at(i));
+	}
+	return array;
+}
+QVector<QJsonObject> JsonObjectRange::toVector() const
+{
+	QVector<QJsonObject> vector;
+	vector.reserve(m_size);
+	for (int i = 0; i < m_size; ++i) {
+		vector.append(at(i));
+	}
+	return vector;
+}
+
+JsonObjectRange JsonObjectRange::write(QJsonObject *data, const QJsonArray &items, const bool columnar, const Schema &schema)
+{
+	// only worth it, and only possible, if there is more than one item and all have the same keys
+	const QStringList keys = columnar && items.size() > 1 ? items.first().toObject().keys() : QStringList();
+	bool uniform = !keys.isEmpty();
+	for (int i = 1; uniform && i < items.size(); ++i) {
+		uniform = items.at(i).toObject().keys() == keys;
+	}
+	if (!uniform) {
+		data->insert("items", items);
+		return JsonObjectRange(items);
+	}
+
+	QVector<QJsonArray> values(keys.size());
+	for (const QJsonValue &item : items) {
+		const QJsonObject object = item.toObject();
+		int column = 0;
+		for (auto it = object.constBegin(); it != object.constEnd(); ++it, ++column) {
+			values[column].append(it.value());
+		}
+	}
+	QJsonArray arrays;
+	for (const QJsonArray &column : values) {
+		arrays.append(column);
+	}
+	data->insert("values", arrays);
+
+	QJsonArray ordinals;
+	for (const QString &key : keys) {
+		const int ordinal = schema.ordinal(key);
+		if (ordinal == -1) {
+			data->insert("columns", QJsonArray::fromStringList(keys));
+			return JsonObjectRange(keys.toVector(), values);
+		}
+		ordinals.append(ordinal);
+	}
+	data->insert("schema", schema.fingerprint());
+	data->insert("ordinals", ordinals);
+	return JsonObjectRange(keys.toVector(), values, schema);
+}
+JsonObjectRange JsonObjectRange::read(const QJsonObject &data)
+{
+	if (!data.contains("columns") && !data.contains("ordinals")) {
+		const QJsonArray items = Json::ensureArray(data, "items");
+		for (const QJsonValue &item : items) {
+			if (!item.isObject()) {
+				throw Exception("Invalid message: items needs to be an array of objects");
+			}
+		}
+		return JsonObjectRange(items);
+	}
+
+	Schema schema;
+	QVector<QString> columns;
+	if (data.contains("ordinals")) {
+		schema = Schema::registered(Json::ensureString(data, "schema"));
+		if (schema.isNull()) {
+			throw Exception("Invalid message: unknown schema");
+		}
+		for (const QJsonValue &value : Json::ensureArray(data, "ordinals")) {
+			const int ordinal = Json::ensureInteger(value);
+			if (ordinal < 0 || ordinal >= schema.columns().size()) {
+				throw Exception("Invalid message: column ordinal out of range");
+			}
+			columns.append(schema.columns().at(ordinal));
+		}
+	} else {
+		columns = Json::ensureIsArrayOf<QString>(data, "columns");
+	}
+	const QJsonArray arrays = Json::ensureArray(data, "values");
+	if (arrays.size() != columns.size()) {
+		throw Exception("Invalid message: values needs to contain one array per column");
+	}
+	QVector<QJsonArray> values;
+	values.reserve(arrays.size());
+	for (const QJsonValue &column : arrays) {
+		values.append(Json::ensureArray(column));
+		if (values.last().size() != values.first().size()) {
+			throw Exception("Invalid message: all columns need to have the same number of values");
+		}
+	}
+	return JsonObjectRange(columns, values, schema);
+}
+Schema JsonObjectRange::replySchema(const QJsonObject &request)
+{
+	if (!request.contains("schema")) {
+		return Schema();
+	}
+	const QString fingerprint = request.value("schema").toString();
+	if (request.contains("schemaColumns")) {
+		const Schema announced(Json::ensureIsArrayOf<QString>(request, "schemaColumns"));
+		// a mismatch means the sender computes fingerprints differently, in which case names are safer
+		if (announced.fingerprint() != fingerprint) {
+			return Schema();
+		}
+		Schema::registerSchema(announced);
+		return announced;
+	}
+	return Schema::registered(fingerprint);
+}
 
 BaseCRUDMessage::BaseCRUDMessage(const QString &channel, const QString &command, const QString &table, const QJsonValue &data)
 	: Message(channel, command, data), m_table(table) {}
@@ -8,18 +174,22 @@ BaseCRUDMessage::BaseCRUDMessage(const Message &origin, const QString &table)
 	: Message(origin), m_table(table) {}
 
 CreateMessage::CreateMessage(const QString &channel, const QString &table, const QVector<QJsonObject> &items)
+	: CreateMessage(channel, table, Json::toJsonArray(items)) {}
+CreateMessage::CreateMessage(const QString &channel, const QString &table, const QJsonArray &items)
 	: BaseCRUDMessage(channel, "create", table,
 					  QJsonObject({{"table", table},
-								   {"items", Json::toJsonArray(items)}})) {}
+								   {"items", items}})),
+	  m_items(items) {}
 CreateMessage::CreateMessage(const QString &channel, const QString &table, const QJsonObject &item)
-	: CreateMessage(channel, table, QVector<QJsonObject>() << item) {}
-CreateMessage::CreateMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items)
+	: CreateMessage(channel, table, QJsonArray({item})) {}
+CreateMessage::CreateMessage(const Message &origin, const QString &table, const JsonObjectRange &items)
 	: BaseCRUDMessage(origin, table), m_items(items) {}
 CreateReplyMessage CreateMessage::createSuccessReply(const QVector<QJsonObject> &items) const
 {
+	const QJsonArray array = Json::toJsonArray(items);
 	return CreateReplyMessage(createReply("create:result", QJsonObject({{"table", table()},
-																		{"items", Json::toJsonArray(items)}})),
-							  table(), items);
+																		{"items", array}})),
+							  table(), JsonObjectRange(array));
 }
 
 ReadMessage::ReadMessage(const QString &channel, const QString &table, const QVector<QVariant> &recordIds, const QVector<QString> &properties)
@@ -31,24 +201,49 @@ ReadMessage::ReadMessage(const QString &channel, const QString &table, const QVe
 	  m_recordIds(recordIds), m_properties(properties) {}
 ReadMessage::ReadMessage(const QString &channel, const QString &table, const QVariant &recordId, const QVector<QString> &properties)
 	: ReadMessage(channel, table, QVector<QVariant>() << recordId, properties) {}
-ReadMessage::ReadMessage(const Message &origin, const QString &table, const QVector<QVariant> &recordIds, const QVector<QString> &properties)
-	: BaseCRUDMessage(origin, table), m_recordIds(recordIds), m_properties(properties) {}
+ReadMessage::ReadMessage(const Message &origin, const QString &table, const QVector<QVariant> &recordIds, const QVector<QString> &properties,
+						 const Schema &replySchema)
+	: BaseCRUDMessage(origin, table), m_recordIds(recordIds), m_properties(properties), m_replySchema(replySchema) {}
+ReadMessage &ReadMessage::setColumnarReply(const bool columnar)
+{
+	QJsonObject obj = dataObject();
+	if (columnar) {
+		obj.insert("columnar", true);
+	} else {
+		obj.remove("columnar");
+	}
+	setData(obj);
+	return *this;
+}
+bool ReadMessage::acceptsColumnarReply() const
+{
+	return dataObject().value("columnar").toBool();
+}
+ReadMessage &ReadMessage::setSchema(const Schema &schema, const bool announce)
+{
+	setData(withSchema(dataObject(), schema, announce));
+	m_replySchema = JsonObjectRange::replySchema(dataObject());
+	return *this;
+}
 ReadReplyMessage ReadMessage::createSuccessReply(const QVector<QJsonObject> &items) const
 {
-	return ReadReplyMessage(createReply("read:result", QJsonObject({{"table", table()},
-																	{"items", Json::toJsonArray(items)}})),
-							table(), items);
+	QJsonObject data({{"table", table()}});
+	const JsonObjectRange range = JsonObjectRange::write(&data, Json::toJsonArray(items), acceptsColumnarReply(), replySchema());
+	return ReadReplyMessage(createReply("read:result", data), table(), range);
 }
-ReadReplyMessage::ReadReplyMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items)
+ReadReplyMessage::ReadReplyMessage(const Message &origin, const QString &table, const JsonObjectRange &items)
 	: BaseCRUDMessage(origin, table), m_items(items) {}
 
 UpdateMessage::UpdateMessage(const QString &channel, const QString &table, const QVector<QJsonObject> &items)
+	: UpdateMessage(channel, table, Json::toJsonArray(items)) {}
+UpdateMessage::UpdateMessage(const QString &channel, const QString &table, const QJsonArray &items)
 	: BaseCRUDMessage(channel, "update", table,
 					  QJsonObject({{"table", table},
-								   {"items", Json::toJsonArray(items)}})) {}
+								   {"items", items}})),
+	  m_items(items) {}
 UpdateMessage::UpdateMessage(const QString &channel, const QString &table, const QJsonObject &item)
-	: UpdateMessage(channel, table, QVector<QJsonObject>() << item) {}
-UpdateMessage::UpdateMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items)
+	: UpdateMessage(channel, table, QJsonArray({item})) {}
+UpdateMessage::UpdateMessage(const Message &origin, const QString &table, const JsonObjectRange &items)
 	: BaseCRUDMessage(origin, table), m_items(items) {}
 UpdateReplyMessage UpdateMessage::createSuccessReply() const
 {
@@ -71,8 +266,10 @@ DeleteReplyMessage DeleteMessage::createSuccessReply() const
 
 IndexMessage::IndexMessage(const QString &channel, const QString &table)
 	: BaseCRUDMessage(channel, "index", table, QJsonObject({{"table", table}})) {}
-IndexMessage::IndexMessage(const Message &origin, const QString &table, const Filter &filter, const int limit, const int offset, const QPair<QString, Qt::SortOrder> &order, const int since)
-	: BaseCRUDMessage(origin, table), m_filter(filter), m_limit(limit), m_offset(offset), m_order(order), m_since(since) {}
+IndexMessage::IndexMessage(const Message &origin, const QString &table, const Filter &filter, const int limit, const int offset, const QPair<QString, Qt::SortOrder> &order, const int since,
+						   const int chunkSize, const int credit, const Schema &replySchema)
+	: BaseCRUDMessage(origin, table), m_filter(filter), m_limit(limit), m_offset(offset), m_order(order), m_since(since), m_chunkSize(chunkSize), m_credit(credit),
+	  m_replySchema(replySchema) {}
 
 IndexMessage &IndexMessage::setFilter(const Filter &filter)
 {
@@ -137,12 +334,67 @@ IndexMessage &IndexMessage::setSince(const int since)
 	return *this;
 }
 
+IndexMessage &IndexMessage::setChunkSize(const int chunkSize, const int credit)
+{
+	m_chunkSize = chunkSize;
+	m_credit = chunkSize == -1 ? -1 : credit;
+	QJsonObject obj = dataObject();
+	if (m_chunkSize == -1) {
+		obj.remove("chunkSize");
+		obj.remove("credit");
+	} else {
+		obj.insert("chunkSize", m_chunkSize);
+		obj.insert("credit", m_credit);
+	}
+	setData(obj);
+	return *this;
+}
+IndexMessage &IndexMessage::setColumnarReply(const bool columnar)
+{
+	QJsonObject obj = dataObject();
+	if (columnar) {
+		obj.insert("columnar", true);
+	} else {
+		obj.remove("columnar");
+	}
+	setData(obj);
+	return *this;
+}
+bool IndexMessage::acceptsColumnarReply() const
+{
+	return dataObject().value("columnar").toBool();
+}
+IndexMessage &IndexMessage::setSchema(const Schema &schema, const bool announce)
+{
+	setData(withSchema(dataObject(), schema, announce));
+	m_replySchema = JsonObjectRange::replySchema(dataObject());
+	return *this;
+}
 IndexReplyMessage IndexMessage::createSuccessReply(const QVector<QJsonObject> &items) const
 {
-	return IndexReplyMessage(createTargetedReply("index:result", QJsonObject({{"table", table()},
-																			  {"items", Json::toJsonArray(items)}})),
-							 table(), items);
+	return createSuccessReply(Json::toJsonArray(items));
+}
+IndexReplyMessage IndexMessage::createSuccessReply(const QJsonArray &items) const
+{
+	QJsonObject data({{"table", table()}});
+	const JsonObjectRange range = JsonObjectRange::write(&data, items, acceptsColumnarReply(), replySchema());
+	return IndexReplyMessage(createTargetedReply("index:result", data), table(), range);
+}
+IndexReplyMessage IndexMessage::createChunkReply(const QJsonArray &items, const bool final) const
+{
+	QJsonObject data({{"table", table()},
+					  {"final", final}});
+	const JsonObjectRange range = JsonObjectRange::write(&data, items, acceptsColumnarReply(), replySchema());
+	return IndexReplyMessage(createTargetedReply("index:result", data), table(), range);
 }
 
-IndexReplyMessage::IndexReplyMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items)
+IndexReplyMessage::IndexReplyMessage(const Message &origin, const QString &table, const JsonObjectRange &items)
 	: BaseCRUDMessage(origin, table), m_items(items) {}
+Message IndexReplyMessage::createCredit(const int chunks) const
+{
+	// a reply to the chunk, so that it goes to the sender only. partial, as there might be more credit for the same chunk
+	return createTargetedReply(creditCommand(), QJsonObject({{"table", table()},
+															 {"request", Json::toJson(replyTo())},
+															 {"credit", chunks},
+															 {"final", false}}));
+}
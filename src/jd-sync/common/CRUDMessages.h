@@ -1,9 +1,90 @@
 #pragma once
 
 #include <QVector>
+#include <QJsonArray>
+#include <iterator>
 
 #include "Message.h"
 #include "Filter.h"
+#include "Schema.h"
+
+/// The items of a CRUD message, in one of two layouts
+///
+/// The default layout is an array of objects ("items"). The columnar layout ("columns" and
+/// "values") has the list of column names once, followed by one array of values per column, which
+/// avoids repeating the names in every row. It is only used if all items have the same keys.
+///
+/// If both sides know the Schema of the items the columnar layout may instead have the fingerprint
+/// of the schema ("schema") and the ordinals of the columns in it ("ordinals").
+///
+/// Iterating creates the objects on the fly, without first copying them into a QVector. Consumers
+/// that want to avoid that can use columns() and value() for the columnar layout.
+class JsonObjectRange
+{
+public:
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = QJsonObject;
+		using difference_type = int;
+		using pointer = const QJsonObject *;
+		using reference = QJsonObject;
+
+		explicit const_iterator(const JsonObjectRange *range, const int index) : m_range(range), m_index(index) {}
+
+		QJsonObject operator*() const { return m_range->at(m_index); }
+		const_iterator &operator++() { ++m_index; return *this; }
+		const_iterator operator++(int) { const_iterator old = *this; ++m_index; return old; }
+		bool operator==(const const_iterator &other) const { return m_index == other.m_index && m_range == other.m_range; }
+		bool operator!=(const const_iterator &other) const { return !operator==(other); }
+
+	private:
+		const JsonObjectRange *m_range;
+		int m_index;
+	};
+
+	explicit JsonObjectRange(const QJsonArray &array = QJsonArray());
+	explicit JsonObjectRange(const QVector<QString> &columns, const QVector<QJsonArray> &values, const Schema &schema = Schema());
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, m_size); }
+	int size() const { return m_size; }
+	bool isEmpty() const { return m_size == 0; }
+	QJsonObject at(const int index) const;
+
+	bool isColumnar() const { return !m_columns.isEmpty(); }
+	/// column names of the columnar layout
+	QVector<QString> columns() const { return m_columns; }
+	/// a single value of the columnar layout
+	QJsonValue value(const int row, const int column) const { return m_values.at(column).at(row); }
+	/// fingerprint of the schema the columns are from, if they were sent as ordinals
+	QString schema() const { return m_schema; }
+	/// ordinals of the columns in the schema, if they were sent as ordinals
+	QVector<int> ordinals() const { return m_ordinals; }
+
+	/// the items in the default layout
+	QJsonArray array() const;
+	QVector<QJsonObject> toVector() const;
+
+	/// puts the items into the data of a message, in the columnar layout if requested and possible
+	/// @param schema if not null and containing all columns, columns are referred to by ordinal
+	static JsonObjectRange write(QJsonObject *data, const QJsonArray &items, const bool columnar, const Schema &schema = Schema());
+	/// reads the items from the data of a message, in whichever layout they are
+	/// @throws Exception if they are in neither layout or refer to an unknown schema
+	static JsonObjectRange read(const QJsonObject &data);
+	/// the schema a read or index request asks its reply to use, null if it is unknown
+	/// @note registers announced schemas, so it is only called once per request (see Message::toIndex)
+	static Schema replySchema(const QJsonObject &request);
+
+private:
+	QJsonArray m_array;
+	QVector<QString> m_columns;
+	QVector<QJsonArray> m_values;
+	QString m_schema;
+	QVector<int> m_ordinals;
+	int m_size;
+};
 
 class BaseCRUDMessage : public Message
 {
@@ -21,15 +102,16 @@ class CreateMessage : public BaseCRUDMessage
 {
 public:
 	explicit CreateMessage(const QString &channel, const QString &table, const QVector<QJsonObject> &items);
+	explicit CreateMessage(const QString &channel, const QString &table, const QJsonArray &items);
 	explicit CreateMessage(const QString &channel, const QString &table, const QJsonObject &item);
-	explicit CreateMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items);
+	explicit CreateMessage(const Message &origin, const QString &table, const JsonObjectRange &items);
 
-	QVector<QJsonObject> items() const { return m_items; }
+	JsonObjectRange items() const { return m_items; }
 
 	CreateReplyMessage createSuccessReply(const QVector<QJsonObject> &items) const;
 
 private:
-	QVector<QJsonObject> m_items;
+	JsonObjectRange m_items;
 };
 class CreateReplyMessage : public CreateMessage
 {
@@ -42,41 +124,53 @@ class ReadMessage : public BaseCRUDMessage
 public:
 	explicit ReadMessage(const QString &channel, const QString &table, const QVector<QVariant> &recordIds, const QVector<QString> &properties = QVector<QString>());
 	explicit ReadMessage(const QString &channel, const QString &table, const QVariant &recordId, const QVector<QString> &properties = QVector<QString>());
-	explicit ReadMessage(const Message &origin, const QString &table, const QVector<QVariant> &recordIds, const QVector<QString> &properties);
+	explicit ReadMessage(const Message &origin, const QString &table, const QVector<QVariant> &recordIds, const QVector<QString> &properties,
+						 const Schema &replySchema = Schema());
 
 	QVector<QVariant> recordIds() const { return m_recordIds; }
 	QVector<QString> properties() const { return m_properties; }
 
+	/// tells the receiver that the reply may use the columnar layout, see JsonObjectRange
+	ReadMessage &setColumnarReply(const bool columnar = true);
+	bool acceptsColumnarReply() const;
+	/// tells the receiver that the columnar layout may refer to the columns of schema by ordinal
+	/// @param announce include the columns, needed the first time the schema is used on a channel
+	ReadMessage &setSchema(const Schema &schema, const bool announce);
+	/// the schema to use for the reply, null if the receiver does not know the one asked for
+	Schema replySchema() const { return m_replySchema; }
+
 	ReadReplyMessage createSuccessReply(const QVector<QJsonObject> &items) const;
 
 private:
 	QVector<QVariant> m_recordIds;
 	QVector<QString> m_properties;
+	Schema m_replySchema;
 };
 class ReadReplyMessage : public BaseCRUDMessage
 {
 public:
-	explicit ReadReplyMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items);
+	explicit ReadReplyMessage(const Message &origin, const QString &table, const JsonObjectRange &items);
 
-	QVector<QJsonObject> items() const { return m_items; }
+	JsonObjectRange items() const { return m_items; }
 
 private:
-	QVector<QJsonObject> m_items;
+	JsonObjectRange m_items;
 };
 
 class UpdateMessage : public BaseCRUDMessage
 {
 public:
 	explicit UpdateMessage(const QString &channel, const QString &table, const QVector<QJsonObject> &items);
+	explicit UpdateMessage(const QString &channel, const QString &table, const QJsonArray &items);
 	explicit UpdateMessage(const QString &channel, const QString &table, const QJsonObject &item);
-	explicit UpdateMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items);
+	explicit UpdateMessage(const Message &origin, const QString &table, const JsonObjectRange &items);
 
-	QVector<QJsonObject> items() const { return m_items; }
+	JsonObjectRange items() const { return m_items; }
 
 	UpdateReplyMessage createSuccessReply() const;
 
 private:
-	QVector<QJsonObject> m_items;
+	JsonObjectRange m_items;
 };
 class UpdateReplyMessage : public UpdateMessage
 {
@@ -108,13 +202,16 @@ class IndexMessage : public BaseCRUDMessage
 {
 public:
 	explicit IndexMessage(const QString &channel, const QString &table);
-	explicit IndexMessage(const Message &origin, const QString &table, const Filter &filter, const int limit, const int offset, const QPair<QString, Qt::SortOrder> &order, const int since);
+	explicit IndexMessage(const Message &origin, const QString &table, const Filter &filter, const int limit, const int offset, const QPair<QString, Qt::SortOrder> &order, const int since,
+						  const int chunkSize = -1, const int credit = -1, const Schema &replySchema = Schema());
 
 	Filter filter() const { return m_filter; }
 	int limit() const { return m_limit; }
 	int offset() const { return m_offset; }
 	QPair<QString, Qt::SortOrder> order() const { return m_order; }
 	int since() const { return m_since; }
+	int chunkSize() const { return m_chunkSize; }
+	int credit() const { return m_credit; }
 
 	bool hasOrder() const { return !m_order.first.isEmpty(); }
 
@@ -123,8 +220,22 @@ public:
 	IndexMessage &setOffset(const int offset);
 	IndexMessage &setOrder(const QPair<QString, Qt::SortOrder> &order);
 	IndexMessage &setSince(const int since);
+	/// asks for the reply to be streamed in chunks of at most chunkSize items, see IndexReplyStream
+	/// @param credit number of chunks that may be sent before waiting for more credit
+	IndexMessage &setChunkSize(const int chunkSize, const int credit = 4);
+	/// tells the receiver that the reply may use the columnar layout, see JsonObjectRange
+	IndexMessage &setColumnarReply(const bool columnar = true);
+	bool acceptsColumnarReply() const;
+	/// tells the receiver that the columnar layout may refer to the columns of schema by ordinal
+	/// @param announce include the columns, needed the first time the schema is used on a channel
+	IndexMessage &setSchema(const Schema &schema, const bool announce);
+	/// the schema to use for the reply, null if the receiver does not know the one asked for
+	Schema replySchema() const { return m_replySchema; }
 
 	IndexReplyMessage createSuccessReply(const QVector<QJsonObject> &items) const;
+	IndexReplyMessage createSuccessReply(const QJsonArray &items) const;
+	/// one part of a streamed reply, the last one has final set
+	IndexReplyMessage createChunkReply(const QJsonArray &items, const bool final) const;
 
 private:
 	Filter m_filter;
@@ -132,14 +243,24 @@ private:
 	int m_offset = -1;
 	QPair<QString, Qt::SortOrder> m_order;
 	int m_since = -1;
+	int m_chunkSize = -1;
+	int m_credit = -1;
+	Schema m_replySchema;
 };
 class IndexReplyMessage : public BaseCRUDMessage
 {
 public:
-	explicit IndexReplyMessage(const Message &origin, const QString &table, const QVector<QJsonObject> &items);
+	explicit IndexReplyMessage(const Message &origin, const QString &table, const JsonObjectRange &items);
+
+	JsonObjectRange items() const { return m_items; }
+	/// false for all but the last chunk of a streamed reply
+	bool isFinal() const { return !isPartialReply(); }
+	/// allows the sender of a streamed reply to send that many more chunks, as a reply to this chunk
+	/// @note replies to replies only reach the actor that is waiting for them, see MessageHub::expectReply
+	Message createCredit(const int chunks) const;
 
-	QVector<QJsonObject> items() const { return m_items; }
+	static QString creditCommand() { return QStringLiteral("index:credit"); }
 
 private:
-	QVector<QJsonObject> m_items;
+	JsonObjectRange m_items;
 };
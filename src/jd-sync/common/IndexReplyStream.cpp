@@ -0,0 +1,87 @@
+#include "IndexReplyStream.h"
+
+#include <jd-util/Json.h>
+
+#include "Atom.h"
+
+IndexReplyStream::IndexReplyStream(MessageHub *hub, const IndexMessage &request, const QJsonArray &items)
+	: QObject(nullptr), AbstractActor(hub), m_request(request), m_items(items), m_credit(qMax(1, request.credit())),
+	  m_creditCommand(Atom::intern(IndexReplyMessage::creditCommand())), m_idleTimer(this)
+{
+	m_idleTimer.setSingleShot(true);
+	m_idleTimer.setInterval(IdleTimeout);
+	connect(&m_idleTimer, &QTimer::timeout, this, &IndexReplyStream::timedOut);
+}
+
+void IndexReplyStream::send(MessageHub *hub, const IndexMessage &request, const QJsonArray &items)
+{
+	(new IndexReplyStream(hub, request, items))->sendChunks();
+}
+
+void IndexReplyStream::receive(const Message &msg)
+{
+	if (m_finished || msg.commandAtom() != m_creditCommand
+			|| !Atom::sameName(msg.channelAtom(), msg.channel(), m_request.channelAtom(), m_request.channel())) {
+		return;
+	}
+	const QJsonObject data = msg.dataObject();
+	if (Json::ensureUuid(data, "request") != m_request.id()) {
+		return;
+	}
+	m_credit += Json::ensureInteger(data, "credit");
+	sendChunks();
+}
+
+bool IndexReplyStream::expectsReplyTo(const Message &msg) const
+{
+	return msg.isPartialReply() && msg.replyTo() == m_request.id();
+}
+
+void IndexReplyStream::reset()
+{
+	// the requester will ask again
+	finish();
+}
+
+void IndexReplyStream::sendChunks()
+{
+	const int chunkSize = m_request.chunkSize();
+	if (chunkSize <= 0) {
+		// the requester does not know about streaming, or does not want it
+		AbstractActor::send(m_request.createSuccessReply(m_items));
+		finish();
+		return;
+	}
+
+	while (m_credit > 0 && m_position < m_items.size()) {
+		QJsonArray chunk;
+		const int end = qMin(m_position + chunkSize, m_items.size());
+		for (; m_position < end; ++m_position) {
+			chunk.append(m_items.at(m_position));
+		}
+		AbstractActor::send(m_request.createChunkReply(chunk, false));
+		--m_credit;
+	}
+	if (m_position >= m_items.size()) {
+		// the terminator does not need any credit
+		AbstractActor::send(m_request.createChunkReply(QJsonArray(), true));
+		finish();
+	} else {
+		m_idleTimer.start();
+	}
+}
+
+void IndexReplyStream::timedOut()
+{
+	AbstractActor::send(m_request.createErrorReply(QStringLiteral("Timed out waiting for credit")));
+	finish();
+}
+void IndexReplyStream::finish()
+{
+	m_finished = true;
+	m_idleTimer.stop();
+	m_items = QJsonArray();
+	m_position = 0;
+	m_credit = 0;
+	deleteLater();
+}
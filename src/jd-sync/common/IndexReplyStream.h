@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QObject>
+#include <QJsonArray>
+#include <QTimer>
+
+#include "AbstractActor.h"
+#include "CRUDMessages.h"
+
+/// Sends the result of an index request, streamed in chunks if the requester asked for it
+///
+/// Without a chunk size in the request this is the same as sending createSuccessReply(). Otherwise
+/// the items are sent in chunks of at most that many items followed by an empty final chunk, but
+/// only as many chunks as the requester has given credit for (with the request and with
+/// index:credit messages). Deletes itself once done, or (with an error reply) if the requester stops giving credit.
+class IndexReplyStream : public QObject, public AbstractActor
+{
+	Q_OBJECT
+	INTROSPECTION
+public:
+	/// time after which a stream that is waiting for credit is abandoned
+	enum
+	{
+		IdleTimeout = 60 * 1000
+	};
+
+	static void send(MessageHub *hub, const IndexMessage &request, const QJsonArray &items);
+
+private:
+	explicit IndexReplyStream(MessageHub *hub, const IndexMessage &request, const QJsonArray &items);
+
+	void receive(const Message &msg) override;
+	void reset() override;
+	/// credit comes as a reply to the chunks
+	bool expectsReplyTo(const Message &msg) const override;
+
+	IndexMessage m_request;
+	QJsonArray m_items;
+	int m_position = 0;
+	int m_credit;
+	const int m_creditCommand;
+	QTimer m_idleTimer;
+	bool m_finished = false;
+
+	void sendChunks();
+	/// tells the requester that we are giving up
+	void timedOut();
+	void finish();
+};
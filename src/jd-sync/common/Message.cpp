@@ -3,7 +3,10 @@
 #include <QDebug>
 
 #include <jd-util/Json.h>
+#include <jd-util/Exception.h>
 
+#include "Atom.h"
+#include "MessageIdGenerator.h"
 #include "CRUDMessages.h"
 #include "AbstractActor.h"
 
@@ -12,39 +15,185 @@ QT_WARNING_DISABLE_CLANG("-Wglobal-constructors")
 static int metaType = qRegisterMetaType<Message>();
 QT_WARNING_POP
 
+/// the decoded data of a CRUD message, see Message::crudPayload
+class CRUDPayload
+{
+public:
+	explicit CRUDPayload(const int command, const QJsonObject &obj)
+		: table(Json::ensureString(obj, "table"))
+	{
+		switch (command) {
+		case Atom::Create:
+		case Atom::Update:
+		case Atom::CreateResult:
+		case Atom::ReadResult:
+		case Atom::UpdateResult:
+		case Atom::IndexResult:
+			items = JsonObjectRange::read(obj);
+			break;
+		case Atom::Read:
+			recordIds = Json::ensureIsArrayOf<QVariant>(obj, "ids");
+			properties = Json::ensureIsArrayOf<QString>(obj, "properties", QVector<QString>());
+			replySchema = JsonObjectRange::replySchema(obj);
+			break;
+		case Atom::Delete:
+		case Atom::DeleteResult:
+			recordIds = Json::ensureIsArrayOf<QVariant>(obj, "ids");
+			break;
+		case Atom::Index:
+			filter = obj.contains("filter") ? Filter::fromJson(Json::ensureObject(obj, "filter")) : Filter();
+			limit = Json::ensureInteger(obj, "limit", -1);
+			offset = Json::ensureInteger(obj, "offset", -1);
+			order = qMakePair(Json::ensureString(obj, "order", QString()), Json::ensureBoolean(obj, "orderAsc", true) ? Qt::AscendingOrder : Qt::DescendingOrder);
+			since = Json::ensureInteger(obj, "since", -1);
+			chunkSize = Json::ensureInteger(obj, "chunkSize", -1);
+			credit = Json::ensureInteger(obj, "credit", -1);
+			replySchema = JsonObjectRange::replySchema(obj);
+			break;
+		}
+	}
+
+	QString table;
+	JsonObjectRange items;
+	QVector<QVariant> recordIds;
+	QVector<QString> properties;
+	Filter filter;
+	int limit = -1;
+	int offset = -1;
+	QPair<QString, Qt::SortOrder> order;
+	int since = -1;
+	int chunkSize = -1;
+	int credit = -1;
+	/// resolved here so that the registry is consulted once per request, not once per reply
+	Schema replySchema;
+};
+
+MessageData::MessageData() {}
+MessageData::MessageData(const MessageData &other)
+	: QSharedData(other), channel(other.channel), command(other.command), channelAtom(other.channelAtom), commandAtom(other.commandAtom),
+	  data(other.data), id(other.id), replyTo(other.replyTo), flags(other.flags), timestamp(other.timestamp),
+	  conflationKey(other.conflationKey)
+{
+	// the caches are not copied, the copy is about to be modified
+}
+MessageData::~MessageData()
+{
+	clearCaches();
+}
+void MessageData::clearCaches()
+{
+	delete crud.fetchAndStoreOrdered(nullptr);
+	for (QAtomicPointer<QByteArray> &bytes : encoded) {
+		delete bytes.fetchAndStoreOrdered(nullptr);
+	}
+}
+
+namespace
+{
+// shared by all default constructed (null) messages, so that creating one does not allocate
+MessageData *sharedNull()
+{
+	static MessageData *null = []() {
+		MessageData *data = new MessageData;
+		data->ref.ref(); // never deleted
+		return data;
+	}();
+	return null;
+}
+}
+
 Message::Message(const QString &channel, const QString &cmd, const QJsonValue &data)
-	: m_channel(channel), m_command(cmd), m_data(data), m_id(QUuid::createUuid()) {}
+	: d(new MessageData)
+{
+	d->channel = channel;
+	d->command = cmd;
+	d->channelAtom = Atom::intern(channel);
+	d->commandAtom = Atom::intern(cmd);
+	d->data = data;
+	d->id = MessageIdGenerator::instance()->next();
+}
 Message::Message(const QString &channel, const QString &cmd, const QJsonValue &data, const QUuid &id, const QUuid &replyTo, const int timestamp)
-	: m_channel(channel), m_command(cmd), m_data(data), m_id(id), m_replyTo(replyTo), m_timestamp(timestamp) {}
-Message::Message() {}
+	: d(new MessageData)
+{
+	d->channel = channel;
+	d->command = cmd;
+	// only used for received messages, whose names must not grow the atom table
+	d->channelAtom = Atom::find(channel);
+	d->commandAtom = Atom::find(cmd);
+	d->data = data;
+	d->id = id;
+	d->replyTo = replyTo;
+	d->timestamp = timestamp;
+}
+Message::Message(const Message &origin, const QString &cmd, const QJsonValue &data)
+	: d(new MessageData)
+{
+	d->channel = origin.d->channel;
+	d->command = cmd;
+	d->channelAtom = origin.d->channelAtom;
+	d->commandAtom = Atom::intern(cmd);
+	d->data = data;
+	d->id = MessageIdGenerator::instance()->next();
+}
+Message::Message()
+	: d(sharedNull()) {}
+Message::Message(const Message &other) = default;
+Message::Message(Message &&other) noexcept = default;
+Message::~Message() = default;
+
+Message &Message::operator=(const Message &other) = default;
+Message &Message::operator=(Message &&other) noexcept = default;
+
+void Message::setChannel(const QString &channel)
+{
+	d->channel = channel;
+	d->channelAtom = Atom::intern(channel);
+	d->clearCaches();
+}
+void Message::setCommand(const QString &command)
+{
+	d->command = command;
+	d->commandAtom = Atom::intern(command);
+	d->clearCaches();
+}
+void Message::setData(const QJsonValue &data)
+{
+	d->data = data;
+	d->clearCaches();
+}
+
+bool Message::isPartialReply() const
+{
+	return isReply() && d->data.isObject() && d->data.toObject().value(QStringLiteral("final")) == QJsonValue(false);
+}
 
 QJsonObject Message::dataObject() const
 {
-	return Json::ensureObject(m_data);
+	return Json::ensureObject(d->data);
 }
 QJsonArray Message::dataArray() const
 {
-	return Json::ensureArray(m_data);
+	return Json::ensureArray(d->data);
 }
 
 Message Message::createReply(const QString &command, const QJsonValue &data) const
 {
 	Q_ASSERT_X(!isNull(), "Message::createReply", "cannot reply to null message without an explicit channel");
-	Message reply{m_channel, command, data};
-	reply.m_replyTo = m_id;
+	Message reply{*this, command, data};
+	reply.d->replyTo = d->id;
 	return reply;
 }
 Message Message::createReply(const QString &channel, const QString &command, const QJsonValue &data) const
 {
 	Message reply{channel, command, data};
-	reply.m_replyTo = m_id;
+	reply.d->replyTo = d->id;
 	return reply;
 }
 Message Message::createTargetedReply(const QString &command, const QJsonValue &data) const
 {
 	Q_ASSERT_X(!isNull(), "Message::createReply", "cannot reply to null message without an explicit channel");
-	Message reply{m_channel, command, data};
-	reply.m_replyTo = m_id;
+	Message reply{*this, command, data};
+	reply.d->replyTo = d->id;
 	reply.m_to = m_from;
 	return reply;
 }
@@ -57,25 +206,25 @@ ErrorMessage Message::createErrorReply(const QString &msg) const
 Message Message::createCopy() const
 {
 	Message copy = *this;
-	copy.m_id = QUuid::createUuid();
+	copy.d->id = MessageIdGenerator::instance()->next();
 	return copy;
 }
 
 QJsonObject Message::toJson() const
 {
 	QJsonObject obj = QJsonObject({
-						   {"ch", m_channel},
-						   {"cmd", m_command},
-						   {"id", Json::toJson(m_id)}
+						   {"ch", d->channel},
+						   {"cmd", d->command},
+						   {"id", Json::toJson(d->id)}
 					   });
-	if (!m_replyTo.isNull()) {
-		obj.insert("reply", Json::toJson(m_replyTo));
+	if (!d->replyTo.isNull()) {
+		obj.insert("reply", Json::toJson(d->replyTo));
 	}
-	if (!m_data.isNull()) {
-		obj.insert("data", m_data);
+	if (!d->data.isNull()) {
+		obj.insert("data", d->data);
 	}
-	if (m_timestamp != -1) {
-		obj.insert("timestamp", m_timestamp);
+	if (d->timestamp != -1) {
+		obj.insert("timestamp", d->timestamp);
 	}
 	return obj;
 }
@@ -93,9 +242,26 @@ Message Message::fromJson(const QJsonObject &obj)
 				);
 }
 
+const CRUDPayload &Message::crudPayload() const
+{
+	CRUDPayload *payload = d->crud.loadAcquire();
+	if (!payload) {
+		// the message might be shared between threads, whoever finishes decoding first wins
+		CRUDPayload *decoded = new CRUDPayload(d->commandAtom, dataObject());
+		if (d->crud.testAndSetOrdered(nullptr, decoded)) {
+			payload = decoded;
+		} else {
+			delete decoded;
+			payload = d->crud.loadAcquire();
+		}
+	}
+	return *payload;
+}
+
 bool Message::operator==(const Message &other) const
 {
-	return m_command == other.m_command && m_channel == other.m_channel && m_data == other.m_data;
+	return d == other.d || (Atom::sameName(d->commandAtom, d->command, other.d->commandAtom, other.d->command)
+							&& Atom::sameName(d->channelAtom, d->channel, other.d->channelAtom, other.d->channel) && d->data == other.d->data);
 }
 bool Message::operator!=(const Message &other) const
 {
@@ -104,47 +270,47 @@ bool Message::operator!=(const Message &other) const
 
 bool Message::isError() const
 {
-	return m_command == "error";
+	return d->commandAtom == Atom::Error;
 }
 bool Message::isCreate() const
 {
-	return m_command == "create";
+	return d->commandAtom == Atom::Create;
 }
 bool Message::isRead() const
 {
-	return m_command == "read";
+	return d->commandAtom == Atom::Read;
 }
 bool Message::isUpdate() const
 {
-	return m_command == "update";
+	return d->commandAtom == Atom::Update;
 }
 bool Message::isDelete() const
 {
-	return m_command == "delete";
+	return d->commandAtom == Atom::Delete;
 }
 bool Message::isIndex() const
 {
-	return m_command == "index";
+	return d->commandAtom == Atom::Index;
 }
 bool Message::isCreateReply() const
 {
-	return m_command == "create:result";
+	return d->commandAtom == Atom::CreateResult;
 }
 bool Message::isReadReply() const
 {
-	return m_command == "read:result";
+	return d->commandAtom == Atom::ReadResult;
 }
 bool Message::isUpdateReply() const
 {
-	return m_command == "update:result";
+	return d->commandAtom == Atom::UpdateResult;
 }
 bool Message::isDeleteReply() const
 {
-	return m_command == "delete:result";
+	return d->commandAtom == Atom::DeleteResult;
 }
 bool Message::isIndexReply() const
 {
-	return m_command == "index:result";
+	return d->commandAtom == Atom::IndexResult;
 }
 
 ErrorMessage Message::toError() const
@@ -155,64 +321,63 @@ ErrorMessage Message::toError() const
 CreateMessage Message::toCreate() const
 {
 	Q_ASSERT_X(isCreate(), "Message::toCreate", "invalid message conversion");
-	return CreateMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QJsonObject>(dataObject(), "items"));
+	const CRUDPayload &payload = crudPayload();
+	return CreateMessage(*this, payload.table, payload.items);
 }
 ReadMessage Message::toRead() const
 {
 	Q_ASSERT_X(isRead(), "Message::toRead", "invalid message conversion");
-	return ReadMessage(*this,
-					   Json::ensureString(dataObject(), "table"),
-					   Json::ensureIsArrayOf<QVariant>(dataObject(), "ids"),
-					   Json::ensureIsArrayOf<QString>(dataObject(), "properties", QVector<QString>()));
+	const CRUDPayload &payload = crudPayload();
+	return ReadMessage(*this, payload.table, payload.recordIds, payload.properties, payload.replySchema);
 }
 UpdateMessage Message::toUpdate() const
 {
 	Q_ASSERT_X(isUpdate(), "Message::toUpdate", "invalid message conversion");
-	return UpdateMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QJsonObject>(dataObject(), "items"));
+	const CRUDPayload &payload = crudPayload();
+	return UpdateMessage(*this, payload.table, payload.items);
 }
 DeleteMessage Message::toDelete() const
 {
 	Q_ASSERT_X(isDelete(), "Message::toDelete", "invalid message conversion");
-	return DeleteMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QVariant>(dataObject(), "ids"));
+	const CRUDPayload &payload = crudPayload();
+	return DeleteMessage(*this, payload.table, payload.recordIds);
 }
 IndexMessage Message::toIndex() const
 {
 	Q_ASSERT_X(isIndex(), "Message::toIndex", "invalid message conversion");
-	const QJsonObject obj = dataObject();
-	return IndexMessage(*this,
-						Json::ensureString(obj, "table"),
-						obj.contains("filter") ? Filter::fromJson(Json::ensureObject(obj, "filter")) : Filter(),
-						Json::ensureInteger(obj, "limit", -1),
-						Json::ensureInteger(obj, "offset", -1),
-						qMakePair(Json::ensureString(obj, "order", QString()), Json::ensureBoolean(obj, "orderAsc", true) ? Qt::AscendingOrder : Qt::DescendingOrder),
-						Json::ensureInteger(obj, "since", -1)
-						);
+	const CRUDPayload &payload = crudPayload();
+	return IndexMessage(*this, payload.table, payload.filter, payload.limit, payload.offset, payload.order, payload.since, payload.chunkSize, payload.credit, payload.replySchema);
 }
 
 CreateReplyMessage Message::toCreateReply() const
 {
 	Q_ASSERT_X(isCreateReply(), "Message::toCreateReply", "invalid message conversion");
-	return CreateReplyMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QJsonObject>(dataObject(), "items"));
+	const CRUDPayload &payload = crudPayload();
+	return CreateReplyMessage(*this, payload.table, payload.items);
 }
 ReadReplyMessage Message::toReadReply() const
 {
 	Q_ASSERT_X(isReadReply(), "Message::toReadReply", "invalid message conversion");
-	return ReadReplyMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QJsonObject>(dataObject(), "items"));
+	const CRUDPayload &payload = crudPayload();
+	return ReadReplyMessage(*this, payload.table, payload.items);
 }
 UpdateReplyMessage Message::toUpdateReply() const
 {
 	Q_ASSERT_X(isUpdateReply(), "Message::toUpdateReply", "invalid message conversion");
-	return UpdateReplyMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QJsonObject>(dataObject(), "items"));
+	const CRUDPayload &payload = crudPayload();
+	return UpdateReplyMessage(*this, payload.table, payload.items);
 }
 DeleteReplyMessage Message::toDeleteReply() const
 {
 	Q_ASSERT_X(isDeleteReply(), "Message::toDeleteReply", "invalid message conversion");
-	return DeleteReplyMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QVariant>(dataObject(), "ids"));
+	const CRUDPayload &payload = crudPayload();
+	return DeleteReplyMessage(*this, payload.table, payload.recordIds);
 }
 IndexReplyMessage Message::toIndexReply() const
 {
 	Q_ASSERT_X(isIndexReply(), "Message::toIndexReply", "invalid message conversion");
-	return IndexReplyMessage(*this, Json::ensureString(dataObject(), "table"), Json::ensureIsArrayOf<QJsonObject>(dataObject(), "items"));
+	const CRUDPayload &payload = crudPayload();
+	return IndexReplyMessage(*this, payload.table, payload.items);
 }
 
 QDebug &operator<<(QDebug &dbg, const Message &msg)
@@ -230,17 +395,21 @@ QDebug &operator<<(QDebug &dbg, const Message &msg)
 		dbg.nospace().noquote() << "ErrorMessage(id=" << id;
 		dbg.nospace().quote() << " ch=" << msg.channel() << " message=" << msg.toError().errorString();
 	} else if (msg.isCreate()) {
+		const CreateMessage create = msg.toCreate();
 		dbg.nospace().noquote() << "CreateMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toCreate().table() << " items=" << msg.toCreate().items();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << create.table() << " items=" << create.items().array();
 	} else if (msg.isRead()) {
+		const ReadMessage read = msg.toRead();
 		dbg.nospace().noquote() << "ReadMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toRead().table() << " ids=" << msg.toRead().recordIds();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << read.table() << " ids=" << read.recordIds();
 	} else if (msg.isUpdate()) {
+		const UpdateMessage update = msg.toUpdate();
 		dbg.nospace().noquote() << "UpdateMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toUpdate().table() << " items=" << msg.toUpdate().items();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << update.table() << " items=" << update.items().array();
 	} else if (msg.isDelete()) {
+		const DeleteMessage del = msg.toDelete();
 		dbg.nospace().noquote() << "DeleteMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toDelete().table() << " ids=" << msg.toDelete().recordIds();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << del.table() << " ids=" << del.recordIds();
 	} else if (msg.isIndex()) {
 		const IndexMessage index = msg.toIndex();
 		dbg.nospace().noquote() << "IndexMessage(id=" << id;
@@ -262,20 +431,25 @@ QDebug &operator<<(QDebug &dbg, const Message &msg)
 			dbg.nospace() << " since=" << index.since();
 		}
 	} else if (msg.isCreateReply()) {
+		const CreateReplyMessage reply = msg.toCreateReply();
 		dbg.nospace().noquote() << "CreateReplyMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toCreateReply().table() << " items=" << msg.toCreateReply().items();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << reply.table() << " items=" << reply.items().array();
 	} else if (msg.isReadReply()) {
+		const ReadReplyMessage reply = msg.toReadReply();
 		dbg.nospace().noquote() << "ReadReplyMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toReadReply().table() << " items=" << msg.toReadReply().items();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << reply.table() << " items=" << reply.items().array();
 	} else if (msg.isUpdateReply()) {
+		const UpdateReplyMessage reply = msg.toUpdateReply();
 		dbg.nospace().noquote() << "UpdateReplyMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toUpdateReply().table() << " items=" << msg.toUpdateReply().items();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << reply.table() << " items=" << reply.items().array();
 	} else if (msg.isDeleteReply()) {
+		const DeleteReplyMessage reply = msg.toDeleteReply();
 		dbg.nospace().noquote() << "DeleteReplyMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toDeleteReply().table() << " ids=" << msg.toDeleteReply().recordIds();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << reply.table() << " ids=" << reply.recordIds();
 	} else if (msg.isIndexReply()) {
+		const IndexReplyMessage reply = msg.toIndexReply();
 		dbg.nospace().noquote() << "IndexReplyMessage(id=" << id;
-		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << msg.toIndexReply().table() << " items=" << msg.toIndexReply().items();
+		dbg.nospace().quote() << " ch=" << msg.channel() << " table=" << reply.table() << " items=" << reply.items().array();
 	} else {
 		dbg.nospace().noquote() << "Message(id=" << id;
 		dbg.nospace().quote() << " ch=" << msg.channel() << " cmd=" << msg.command();
@@ -5,6 +5,8 @@
 #include <QJsonObject>
 #include <QFlags>
 #include <QMetaType>
+#include <QSharedData>
+#include <QAtomicPointer>
 
 class AbstractActor;
 class CreateMessage;
@@ -19,11 +21,55 @@ class DeleteReplyMessage;
 class IndexReplyMessage;
 class ErrorMessage;
 
+class CRUDPayload;
+
+/// the implicitly shared part of a Message, see Message
+class MessageData : public QSharedData
+{
+public:
+	explicit MessageData();
+	MessageData(const MessageData &other);
+	~MessageData();
+
+	/// needs to be called whenever the channel, command or data changes
+	void clearCaches();
+
+	QString channel;
+	QString command;
+	int channelAtom = 0;
+	int commandAtom = 0;
+	QJsonValue data;
+	QUuid id;
+	QUuid replyTo;
+	int flags = 0;
+	int timestamp = -1;
+	/// local only, not part of the wire format, see Message::setConflationKey
+	QString conflationKey;
+
+	/// decoded CRUD payload, created on first use by one of the Message::to*() functions
+	mutable QAtomicPointer<CRUDPayload> crud;
+	/// wire representation per MessageCodec::Format, created on first use by MessageCodec::encode
+	mutable QAtomicPointer<QByteArray> encoded[2];
+
+private:
+	MessageData &operator=(const MessageData &) = delete;
+};
+
+/// Messages are implicitly shared: copying one (for example when fanning out to subscribers or
+/// passing it between threads) only increments a reference count, the payload is detached on the
+/// first modification. The routing information (from()/to()) is not part of the shared data, so
+/// setting it never detaches.
 class Message
 {
 public:
 	explicit Message(const QString &channel, const QString &cmd, const QJsonValue &data = QJsonValue());
 	explicit Message();
+	Message(const Message &other);
+	Message(Message &&other) noexcept;
+	~Message();
+
+	Message &operator=(const Message &other);
+	Message &operator=(Message &&other) noexcept;
 
 	enum Flag
 	{
@@ -33,30 +79,42 @@ public:
 	};
 	Q_DECLARE_FLAGS(Flags, Flag)
 
-	QString channel() const { return m_channel; }
-	QString command() const { return m_command; }
-	QUuid id() const { return m_id; }
-	QUuid replyTo() const { return m_replyTo; }
-	int timestamp() const { return m_timestamp; }
-	Flags flags() const { return m_flags; }
+	QString channel() const { return d->channel; }
+	QString command() const { return d->command; }
+	/// @see Atom
+	/// @note Atom::Unknown for names of received messages that are not registered, compare with Atom::sameName
+	int channelAtom() const { return d->channelAtom; }
+	int commandAtom() const { return d->commandAtom; }
+	QUuid id() const { return d->id; }
+	QUuid replyTo() const { return d->replyTo; }
+	int timestamp() const { return d->timestamp; }
+	Flags flags() const { return Flags(QFlag(d->flags)); }
+	QString conflationKey() const { return d->conflationKey; }
 
 	AbstractActor *from() const { return m_from; }
 	AbstractActor *to() const { return m_to; }
 
-	QJsonValue data() const { return m_data; }
+	QJsonValue data() const { return d->data; }
 	QJsonObject dataObject() const;
 	QJsonArray dataArray() const;
 
-	bool isReply() const { return !m_replyTo.isNull(); }
-	bool isBypassingAuth() const { return m_flags & BypassAuth; }
-	bool isInternal() const { return m_flags & Internal; }
-	bool isNull() const { return m_id.isNull(); }
-
-	void setChannel(const QString &channel) { m_channel = channel; }
-	void setCommand(const QString &command) { m_command = command; }
-	void setData(const QJsonValue &data) { m_data = data; }
-	void setTimestamp(const int timestamp) { m_timestamp = timestamp; }
-	Message &setFlags(const Flags &flags) { m_flags = flags; return *this; }
+	bool isReply() const { return !d->replyTo.isNull(); }
+	/// a reply that will be followed by more replies to the same request, marked by final: false in
+	/// the data (see IndexReplyStream)
+	bool isPartialReply() const;
+	bool isBypassingAuth() const { return d->flags & BypassAuth; }
+	bool isInternal() const { return d->flags & Internal; }
+	bool isNull() const { return d->id.isNull(); }
+
+	void setChannel(const QString &channel);
+	void setCommand(const QString &command);
+	void setData(const QJsonValue &data);
+	void setTimestamp(const int timestamp) { d->timestamp = timestamp; d->clearCaches(); }
+	Message &setFlags(const Flags &flags) { d->flags = int(flags); return *this; }
+	/// messages with the same channel, command and conflation key carry the latest state of the
+	/// same thing, a newer one may replace an older one that has not been sent yet
+	/// @note not transmitted, only applies to connections of the hub the message originated in
+	Message &setConflationKey(const QString &key) { d->conflationKey = key; return *this; }
 
 	Message createReply(const QString &command, const QJsonValue &data) const;
 	Message createReply(const QString &channel, const QString &command, const QJsonValue &data) const;
@@ -96,13 +154,7 @@ public: // message types
 	IndexReplyMessage toIndexReply() const;
 
 private:
-	QString m_channel;
-	QString m_command;
-	QJsonValue m_data;
-	QUuid m_id;
-	QUuid m_replyTo;
-	Flags m_flags = NoFlags;
-	int m_timestamp = -1;
+	QSharedDataPointer<MessageData> d;
 
 	friend class AbstractActor;
 	friend class DummyActor; // for tests
@@ -110,7 +162,12 @@ private:
 	AbstractActor *m_to = nullptr;
 
 	friend class MessageHub;
+	friend class MessageCodec;
 	explicit Message(const QString &channel, const QString &cmd, const QJsonValue &data, const QUuid &id, const QUuid &replyTo, const int timestamp);
+	/// a new message on the channel of origin, which might be a received one with an unknown channel atom
+	explicit Message(const Message &origin, const QString &cmd, const QJsonValue &data);
+
+	const CRUDPayload &crudPayload() const;
 };
 Q_DECLARE_OPERATORS_FOR_FLAGS(Message::Flags)
 Q_DECLARE_METATYPE(Message)
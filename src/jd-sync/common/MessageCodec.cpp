@@ -0,0 +1,506 @@
+#include "MessageCodec.h"
+
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+
+#include <jd-util/Json.h>
+#include <jd-util/Exception.h>
+
+#include "Message.h"
+#include "Atom.h"
+
+/*
+ * Binary format, version 1:
+ *
+ *   u8       0xB1 (format version, distinguishes from binary JSON which starts with "qbjs")
+ *   u8       flags (HasReplyTo, HasData, HasTimestamp)
+ *   16 bytes id (RFC 4122 byte order)
+ *   16 bytes replyTo, if HasReplyTo
+ *   name     channel
+ *   name     command
+ *   value    data, if HasData
+ *   varint   timestamp (zig-zag), if HasTimestamp
+ *
+ * A name is a varint tag, the lowest two bits of which give its kind: either a builtin atom (the
+ * remaining bits are the atom) or a literal (the remaining bits are the length of the UTF-8 string
+ * that follows). If the peers use string tables there are two more kinds: an index into the table,
+ * and a literal that is to be inserted into the table after reading it. A value is a type byte
+ * followed by the payload of that type.
+ */
+
+namespace
+{
+constexpr quint8 BinaryVersion1 = 0xB1;
+
+enum HeaderFlag : quint8
+{
+	HasReplyTo = 0x01,
+	HasData = 0x02,
+	HasTimestamp = 0x04
+};
+
+enum NameKind : quint64
+{
+	AtomName = 0,
+	LiteralName = 1,
+	IndexedName = 2,
+	InsertedName = 3
+};
+constexpr int NameKindBits = 2;
+constexpr quint64 NameKindMask = (1 << NameKindBits) - 1;
+
+enum ValueType : quint8
+{
+	NullValue,
+	FalseValue,
+	TrueValue,
+	IntegerValue,
+	DoubleValue,
+	StringValue,
+	ArrayValue,
+	ObjectValue
+};
+
+// doubles outside of this range can not represent all integers, so they are never encoded as integers
+constexpr double MaxSafeInteger = 9007199254740992.0;
+constexpr int MaxNestingDepth = 128;
+
+class Writer
+{
+public:
+	explicit Writer(MessageCodec::StringTable *table) : m_table(table) {}
+
+	void writeByte(const quint8 byte)
+	{
+		m_data.append(char(byte));
+	}
+	void writeVarint(quint64 value)
+	{
+		while (value >= 0x80) {
+			writeByte(quint8(value) | 0x80);
+			value >>= 7;
+		}
+		writeByte(quint8(value));
+	}
+	void writeSigned(const qint64 value)
+	{
+		writeVarint((quint64(value) << 1) ^ quint64(value >> 63));
+	}
+	void writeDouble(const double value)
+	{
+		quint64 bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		uchar buffer[8];
+		qToLittleEndian<quint64>(bits, buffer);
+		m_data.append(reinterpret_cast<const char *>(buffer), 8);
+	}
+	void writeUuid(const QUuid &uuid)
+	{
+		uchar buffer[16];
+		qToBigEndian<quint32>(uuid.data1, buffer);
+		qToBigEndian<quint16>(uuid.data2, buffer + 4);
+		qToBigEndian<quint16>(uuid.data3, buffer + 6);
+		std::memcpy(buffer + 8, uuid.data4, 8);
+		m_data.append(reinterpret_cast<const char *>(buffer), 16);
+	}
+	void writeString(const QString &string)
+	{
+		const QByteArray utf8 = string.toUtf8();
+		writeVarint(quint64(utf8.size()));
+		m_data.append(utf8);
+	}
+	void writeName(const QString &name, const int atom)
+	{
+		if (atom >= Atom::Null && atom < Atom::FirstDynamic) {
+			writeVarint((quint64(atom) << NameKindBits) | AtomName);
+			return;
+		}
+		const int index = m_table ? m_table->indexOf(name) : -1;
+		if (index != -1) {
+			writeVarint((quint64(index) << NameKindBits) | IndexedName);
+			return;
+		}
+		const QByteArray utf8 = name.toUtf8();
+		const bool insert = m_table && MessageCodec::StringTable::isWorthInserting(utf8.size());
+		writeVarint((quint64(utf8.size()) << NameKindBits) | (insert ? InsertedName : LiteralName));
+		m_data.append(utf8);
+		if (insert) {
+			m_table->insert(name);
+		}
+	}
+	void writeValue(const QJsonValue &value)
+	{
+		switch (value.type()) {
+		case QJsonValue::Null:
+		case QJsonValue::Undefined:
+			writeByte(NullValue);
+			break;
+		case QJsonValue::Bool:
+			writeByte(value.toBool() ? TrueValue : FalseValue);
+			break;
+		case QJsonValue::Double: {
+			const double number = value.toDouble();
+			if (std::floor(number) == number && std::abs(number) <= MaxSafeInteger && !(number == 0 && std::signbit(number))) {
+				writeByte(IntegerValue);
+				writeSigned(qint64(number));
+			} else {
+				writeByte(DoubleValue);
+				writeDouble(number);
+			}
+			break;
+		}
+		case QJsonValue::String:
+			writeByte(StringValue);
+			writeString(value.toString());
+			break;
+		case QJsonValue::Array: {
+			const QJsonArray array = value.toArray();
+			writeByte(ArrayValue);
+			writeVarint(quint64(array.size()));
+			for (const QJsonValue &item : array) {
+				writeValue(item);
+			}
+			break;
+		}
+		case QJsonValue::Object: {
+			const QJsonObject object = value.toObject();
+			writeByte(ObjectValue);
+			writeVarint(quint64(object.size()));
+			for (auto it = object.constBegin(); it != object.constEnd(); ++it) {
+				writeName(it.key(), -1);
+				writeValue(it.value());
+			}
+			break;
+		}
+		}
+	}
+
+	QByteArray data() const { return m_data; }
+
+private:
+	QByteArray m_data;
+	MessageCodec::StringTable *m_table;
+};
+
+class Reader
+{
+public:
+	explicit Reader(const QByteArray &data, MessageCodec::StringTable *table)
+		: m_pos(data.constData()), m_end(data.constData() + data.size()), m_table(table) {}
+
+	bool atEnd() const { return m_pos == m_end; }
+
+	quint8 readByte()
+	{
+		require(1);
+		return quint8(*m_pos++);
+	}
+	quint64 readVarint()
+	{
+		quint64 value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			const quint8 byte = readByte();
+			value |= quint64(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return value;
+			}
+		}
+		throw Exception("Invalid binary message: varint too long");
+	}
+	qint64 readSigned()
+	{
+		const quint64 raw = readVarint();
+		return qint64(raw >> 1) ^ -qint64(raw & 1);
+	}
+	double readDouble()
+	{
+		require(8);
+		const quint64 bits = qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(m_pos));
+		m_pos += 8;
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+	QUuid readUuid()
+	{
+		require(16);
+		const uchar *data = reinterpret_cast<const uchar *>(m_pos);
+		m_pos += 16;
+		return QUuid(qFromBigEndian<quint32>(data), qFromBigEndian<quint16>(data + 4), qFromBigEndian<quint16>(data + 6),
+					 data[8], data[9], data[10], data[11], data[12], data[13], data[14], data[15]);
+	}
+	QString readUtf8(const quint64 size)
+	{
+		require(size);
+		const QString string = QString::fromUtf8(m_pos, int(size));
+		m_pos += size;
+		return string;
+	}
+	QString readString()
+	{
+		return readUtf8(readVarint());
+	}
+	QString readName()
+	{
+		const quint64 tag = readVarint();
+		switch (tag & NameKindMask) {
+		case AtomName: {
+			const quint64 atom = tag >> NameKindBits;
+			if (atom >= quint64(Atom::FirstDynamic)) {
+				throw Exception("Invalid binary message: unknown atom");
+			}
+			return Atom::toString(int(atom));
+		}
+		case LiteralName:
+			return readUtf8(tag >> NameKindBits);
+		case IndexedName:
+			if (!m_table) {
+				throw Exception("Invalid binary message: string table not in use");
+			}
+			return m_table->at(int(qMin(tag >> NameKindBits, quint64(MessageCodec::StringTable::MaxEntries))));
+		case InsertedName: {
+			const QString name = readUtf8(tag >> NameKindBits);
+			if (!m_table) {
+				throw Exception("Invalid binary message: string table not in use");
+			}
+			m_table->insert(name);
+			return name;
+		}
+		}
+		Q_UNREACHABLE();
+		return QString();
+	}
+	QJsonValue readValue(const int depth = 0)
+	{
+		if (depth > MaxNestingDepth) {
+			throw Exception("Invalid binary message: nested too deeply");
+		}
+		switch (readByte()) {
+		case NullValue: return QJsonValue();
+		case FalseValue: return false;
+		case TrueValue: return true;
+		case IntegerValue: return double(readSigned());
+		case DoubleValue: return readDouble();
+		case StringValue: return readString();
+		case ArrayValue: {
+			// every value is at least one byte, which protects against bogus sizes
+			const quint64 size = readVarint();
+			require(size);
+			QJsonArray array;
+			for (quint64 i = 0; i < size; ++i) {
+				array.append(readValue(depth + 1));
+			}
+			return array;
+		}
+		case ObjectValue: {
+			const quint64 size = readVarint();
+			require(size);
+			require(size * 2);
+			QJsonObject object;
+			for (quint64 i = 0; i < size; ++i) {
+				const QString key = readName();
+				object.insert(key, readValue(depth + 1));
+			}
+			return object;
+		}
+		default:
+			throw Exception("Invalid binary message: unknown value type");
+		}
+	}
+
+private:
+	const char *m_pos;
+	const char *m_end;
+	MessageCodec::StringTable *m_table;
+
+	void require(const quint64 bytes) const
+	{
+		if (quint64(m_end - m_pos) < bytes) {
+			throw Exception("Invalid binary message: unexpected end of data");
+		}
+	}
+};
+}
+
+int MessageCodec::StringTable::indexOf(const QString &string) const
+{
+	const auto it = m_sequences.constFind(string);
+	return it == m_sequences.constEnd() ? -1 : int(m_inserted - 1 - it.value());
+}
+QString MessageCodec::StringTable::at(const int index) const
+{
+	if (index < 0 || index >= m_entries.size()) {
+		throw Exception("Invalid binary message: unknown string table index");
+	}
+	return m_entries.at(m_entries.size() - 1 - index);
+}
+void MessageCodec::StringTable::insert(const QString &string)
+{
+	m_sequences.insert(string, m_inserted++);
+	m_entries.enqueue(string);
+	m_characters += string.size();
+	while (m_entries.size() > MaxEntries || m_characters > MaxCharacters) {
+		const QString evicted = m_entries.dequeue();
+		m_characters -= evicted.size();
+		// the decoder might have been sent the same string twice, in which case the newer one stays
+		const auto it = m_sequences.find(evicted);
+		if (it != m_sequences.end() && it.value() == m_inserted - quint64(m_entries.size()) - 1) {
+			m_sequences.erase(it);
+		}
+	}
+}
+void MessageCodec::StringTable::clear()
+{
+	m_entries.clear();
+	m_sequences.clear();
+	m_inserted = 0;
+	m_characters = 0;
+}
+
+QByteArray MessageCodec::encode(const Message &msg, const Format format)
+{
+	QAtomicPointer<QByteArray> &cache = msg.d->encoded[format];
+	if (const QByteArray *cached = cache.loadAcquire()) {
+		return *cached;
+	}
+	// several connection threads might race here, only one of the results is kept
+	QByteArray *bytes = new QByteArray(encodeUncached(msg, format));
+	if (!cache.testAndSetOrdered(nullptr, bytes)) {
+		delete bytes;
+	}
+	return *cache.loadAcquire();
+}
+static int estimateValueSize(const QJsonValue &value)
+{
+	switch (value.type()) {
+	case QJsonValue::String:
+		return 5 + value.toString().size();
+	case QJsonValue::Double:
+		return 9;
+	case QJsonValue::Array: {
+		int size = 5;
+		for (const QJsonValue &item : value.toArray()) {
+			size += estimateValueSize(item);
+		}
+		return size;
+	}
+	case QJsonValue::Object: {
+		const QJsonObject obj = value.toObject();
+		int size = 5;
+		for (auto it = obj.constBegin(); it != obj.constEnd(); ++it) {
+			size += 5 + it.key().size() + estimateValueSize(it.value());
+		}
+		return size;
+	}
+	default:
+		return 1;
+	}
+}
+int MessageCodec::estimateSize(const Message &msg, const Format format)
+{
+	if (const QByteArray *cached = msg.d->encoded[format].loadAcquire()) {
+		return cached->size();
+	}
+	// header, ids and names
+	return 40 + msg.channel().size() + msg.command().size() + estimateValueSize(msg.data());
+}
+QByteArray MessageCodec::encodeUncached(const Message &msg, const Format format)
+{
+	switch (format) {
+	case JsonFormat:
+		return Json::toBinary(msg.toJson());
+	case BinaryFormat:
+		return encodeBinary(msg, nullptr);
+	}
+	Q_UNREACHABLE();
+	return QByteArray();
+}
+QByteArray MessageCodec::encode(const Message &msg, const Format format, StringTable *table)
+{
+	if (!table || format != BinaryFormat) {
+		return encode(msg, format);
+	}
+	return encodeBinary(msg, table);
+}
+Message MessageCodec::decode(const QByteArray &data, StringTable *table)
+{
+	if (!data.isEmpty() && quint8(data.at(0)) == BinaryVersion1) {
+		return decodeBinary(data, table);
+	}
+	return Message::fromJson(Json::ensureObject(Json::ensureDocument(data)));
+}
+
+QStringList MessageCodec::formatNames()
+{
+	return QStringList() << formatName(BinaryFormat) << formatName(JsonFormat);
+}
+QString MessageCodec::formatName(const Format format)
+{
+	switch (format) {
+	case JsonFormat: return QStringLiteral("json");
+	case BinaryFormat: return QStringLiteral("binary1");
+	}
+	Q_UNREACHABLE();
+	return QString();
+}
+MessageCodec::Format MessageCodec::negotiate(const QStringList &offered)
+{
+	for (const QString &name : offered) {
+		if (name == formatName(BinaryFormat)) {
+			return BinaryFormat;
+		} else if (name == formatName(JsonFormat)) {
+			return JsonFormat;
+		}
+	}
+	return JsonFormat;
+}
+
+QByteArray MessageCodec::encodeBinary(const Message &msg, StringTable *table)
+{
+	quint8 flags = 0;
+	if (!msg.replyTo().isNull()) {
+		flags |= HasReplyTo;
+	}
+	if (!msg.data().isNull() && !msg.data().isUndefined()) {
+		flags |= HasData;
+	}
+	if (msg.timestamp() != -1) {
+		flags |= HasTimestamp;
+	}
+
+	Writer writer(table);
+	writer.writeByte(BinaryVersion1);
+	writer.writeByte(flags);
+	writer.writeUuid(msg.id());
+	if (flags & HasReplyTo) {
+		writer.writeUuid(msg.replyTo());
+	}
+	writer.writeName(msg.channel(), msg.channelAtom());
+	writer.writeName(msg.command(), msg.commandAtom());
+	if (flags & HasData) {
+		writer.writeValue(msg.data());
+	}
+	if (flags & HasTimestamp) {
+		writer.writeSigned(msg.timestamp());
+	}
+	return writer.data();
+}
+Message MessageCodec::decodeBinary(const QByteArray &data, StringTable *table)
+{
+	Reader reader(data, table);
+	reader.readByte(); // version
+	const quint8 flags = reader.readByte();
+	const QUuid id = reader.readUuid();
+	const QUuid replyTo = (flags & HasReplyTo) ? reader.readUuid() : QUuid();
+	const QString channel = reader.readName();
+	const QString command = reader.readName();
+	const QJsonValue value = (flags & HasData) ? reader.readValue() : QJsonValue();
+	const int timestamp = (flags & HasTimestamp) ? int(reader.readSigned()) : -1;
+	if (!reader.atEnd()) {
+		throw Exception("Invalid binary message: trailing data");
+	}
+	return Message(channel, command, value, id, replyTo, timestamp);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QQueue>
+#include <QStringList>
+
+class Message;
+
+/// Serialization of messages for the wire
+///
+/// Two formats are supported: JsonFormat (binary QJsonDocument, understood by all peers) and BinaryFormat, a compact
+/// format with a fixed header, raw UUIDs, builtin atoms instead of channel/command strings and a tagged
+/// value encoding. Peers agree on a format during the client.auth negotiate handshake, decode() accepts
+/// both at any time.
+class MessageCodec
+{
+public:
+	enum Format
+	{
+		JsonFormat,
+		BinaryFormat
+	};
+
+	/// Names recently sent in one direction of a connection, so that they can be referred to by index
+	///
+	/// Works like the dynamic table of HPACK: the encoder and the decoder both have one, which stay the
+	/// same by applying the same insertions (and evictions of the oldest entries) in the same order.
+	/// Messages encoded with a table therefore need to be sent in the order they were encoded in, and
+	/// all of them need to be sent.
+	class StringTable
+	{
+	public:
+		/// the limits are part of the format, so that both sides evict the same entries
+		enum
+		{
+			MaxEntries = 256,
+			MaxCharacters = 8192
+		};
+
+		/// the index of the string, 0 being the most recently inserted one, or -1 if it is not in the table
+		int indexOf(const QString &string) const;
+		/// @throws Exception if there is no such index
+		QString at(const int index) const;
+		void insert(const QString &string);
+		void clear();
+
+		int size() const { return m_entries.size(); }
+		/// short names would not get any shorter, long ones would push out too much
+		static bool isWorthInserting(const int utf8Size) { return utf8Size >= 3 && utf8Size <= 128; }
+
+	private:
+		QQueue<QString> m_entries;
+		QHash<QString, quint64> m_sequences;
+		quint64 m_inserted = 0;
+		int m_characters = 0;
+	};
+
+	/// the result is cached in the message, so encoding a message that is sent to many connections
+	/// (or copies of it) only happens once per format
+	static QByteArray encode(const Message &msg, const Format format);
+	/// like encode(), but refers to names through the given table, if not null and if the format supports it
+	/// @note the result is not cached, and it needs to be sent (see StringTable)
+	static QByteArray encode(const Message &msg, const Format format, StringTable *table);
+	/// the size of encode(msg, format) if it has been cached already, otherwise a rough estimate from the
+	/// contents of the message, for accounting (queue limits) without paying for an encode
+	static int estimateSize(const Message &msg, const Format format);
+	/// detects the format of the given data
+	/// @param table the counterpart of the table used for encoding, if any
+	/// @throws Exception if the data can not be decoded
+	static Message decode(const QByteArray &data, StringTable *table = nullptr);
+
+	/// names of the supported formats, most preferred first
+	static QStringList formatNames();
+	static QString formatName(const Format format);
+	/// returns the first of the offered formats that is supported, or JsonFormat if there is none
+	static Format negotiate(const QStringList &offered);
+
+private:
+	static QByteArray encodeUncached(const Message &msg, const Format format);
+	static QByteArray encodeBinary(const Message &msg, StringTable *table);
+	static Message decodeBinary(const QByteArray &data, StringTable *table);
+};
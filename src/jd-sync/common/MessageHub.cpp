@@ -4,6 +4,7 @@
 
 #include "AbstractActor.h"
 #include "Message.h"
+#include "Atom.h"
 #include <jd-util/Json.h>
 
 Q_LOGGING_CATEGORY(Messages, "tablesync.messages")
@@ -17,7 +18,7 @@ void MessageHub::registerActor(AbstractActor *actor)
 	Q_ASSERT_X(actor->m_hub == this, "MessageHub::registerActor", "attempting to register an actor belonging to a different hub");
 	m_actors.insert(actor);
 	// re-subscribe to channels
-	for (const QString &channel : actor->m_channels) {
+	for (const int channel : actor->m_channels) {
 		subscribeActorTo(actor, channel);
 	}
 }
@@ -25,58 +26,337 @@ void MessageHub::unregisterActor(AbstractActor *actor)
 {
 	Q_ASSERT_X(m_actors.contains(actor), "MessageHub::unregisterActor", "the given actor is not yet registered");
 	m_actors.remove(actor);
-	for (const QString &channel : actor->m_channels) {
+	++m_generation;
+	for (const QUuid &id : actor->m_pendingReplies) {
+		const PendingReply pending = m_pendingReplies.take(id);
+		if (pending.actor && pending.channel != -1) {
+			removeReplyInterest(pending.channel);
+		}
+	}
+	actor->m_pendingReplies.clear();
+	actor->m_pendingReplyOrder.clear();
+	for (const int channel : actor->m_channels) {
 		unsubscribeActorFrom(actor, channel);
 	}
 }
 
-void MessageHub::subscribeActorTo(AbstractActor *actor, const QString &channel)
+QSet<int> MessageHub::channels() const
+{
+	QSet<int> channels;
+	channels.reserve(m_subscriptions.size());
+	for (auto it = m_subscriptions.constBegin(); it != m_subscriptions.constEnd(); ++it) {
+		channels.insert(it.key());
+	}
+	for (auto it = m_replyChannels.constBegin(); it != m_replyChannels.constEnd(); ++it) {
+		channels.insert(it.key());
+	}
+	return channels;
+}
+
+void MessageHub::subscribeActorTo(AbstractActor *actor, const int channel)
 {
 	Q_ASSERT(actor);
-	if (!m_subscriptions.contains(channel)) {
-		sendToAllActors(Message("client", "subscribe", QJsonObject({{"channel", channel}})));
+	if (!m_subscriptions.contains(channel) && !m_replyChannels.contains(channel)) {
+		notify(Message("client", "subscribe", QJsonObject({{"channel", Atom::toString(channel)}})));
+	}
+	QVector<AbstractActor *> &actors = m_subscriptions[channel];
+	if (!actors.contains(actor)) {
+		actors.append(actor);
+		++m_generation;
 	}
-	m_subscriptions[channel].insert(actor);
 }
-void MessageHub::unsubscribeActorFrom(AbstractActor *actor, const QString &channel)
+void MessageHub::unsubscribeActorFrom(AbstractActor *actor, const int channel)
 {
 	Q_ASSERT(actor);
-	m_subscriptions[channel].remove(actor);
-	if (m_subscriptions[channel].isEmpty()) {
-		sendToAllActors(Message("client", "unsubscribe", QJsonObject({{"channel", channel}})));
-		m_subscriptions.remove(channel);
+	auto it = m_subscriptions.find(channel);
+	if (it == m_subscriptions.end()) {
+		return;
+	}
+	it.value().removeOne(actor);
+	++m_generation;
+	if (it.value().isEmpty()) {
+		m_subscriptions.erase(it);
+		if (!m_replyChannels.contains(channel)) {
+			notify(Message("client", "unsubscribe", QJsonObject({{"channel", Atom::toString(channel)}})));
+		}
+	}
+}
+
+void MessageHub::addReplyInterest(const int channel)
+{
+	int &count = m_replyChannels[channel];
+	if (count++ == 0 && !m_subscriptions.contains(channel)) {
+		notify(Message("client", "subscribe", QJsonObject({{"channel", Atom::toString(channel)}})));
+	}
+}
+void MessageHub::removeReplyInterest(const int channel)
+{
+	auto it = m_replyChannels.find(channel);
+	if (it == m_replyChannels.end() || --it.value() > 0) {
+		return;
+	}
+	m_replyChannels.erase(it);
+	if (!m_subscriptions.contains(channel)) {
+		notify(Message("client", "unsubscribe", QJsonObject({{"channel", Atom::toString(channel)}})));
 	}
 }
 
 void MessageHub::messageFromActor(AbstractActor *actor, const Message &msg)
+{
+	Q_UNUSED(actor);
+	if (m_dispatchMode == QueuedDispatch) {
+		m_runQueue.enqueue(msg);
+		drain();
+	} else {
+		route(msg, nullptr);
+	}
+}
+void MessageHub::messagesFromActor(AbstractActor *actor, const QVector<Message> &messages)
+{
+	if (m_dispatchMode == QueuedDispatch) {
+		for (const Message &msg : messages) {
+			m_runQueue.enqueue(msg);
+		}
+		drain();
+		return;
+	}
+	if (messages.size() <= 1) {
+		for (const Message &msg : messages) {
+			messageFromActor(actor, msg);
+		}
+		return;
+	}
+	Deliveries deliveries;
+	for (const Message &msg : messages) {
+		route(msg, &deliveries);
+	}
+	flush(&deliveries);
+}
+
+void MessageHub::notify(const Message &msg)
+{
+	if (m_dispatchMode == QueuedDispatch) {
+		m_runQueue.enqueue(msg);
+		drain();
+	} else {
+		sendToAllActors(msg);
+	}
+}
+
+void MessageHub::drain()
+{
+	// sends from within a delivery only queue, the outermost send keeps going until everything is delivered
+	if (m_draining) {
+		return;
+	}
+	// an actor throwing out of a delivery must not leave the hub thinking it is still draining
+	struct DrainingGuard
+	{
+		bool &draining;
+		~DrainingGuard() { draining = false; }
+	} guard{m_draining};
+	m_draining = true;
+	while (!m_runQueue.isEmpty()) {
+		QQueue<Message> round;
+		round.swap(m_runQueue);
+		Deliveries deliveries;
+		for (const Message &msg : round) {
+			route(msg, &deliveries);
+		}
+		flush(&deliveries);
+	}
+}
+
+bool MessageHub::resolveAtoms(Message *msg)
+{
+	const int channel = msg->channelAtom() == Atom::Unknown ? Atom::find(msg->channel()) : msg->channelAtom();
+	const int command = msg->commandAtom() == Atom::Unknown ? Atom::find(msg->command()) : msg->commandAtom();
+	if (channel == msg->channelAtom() && command == msg->commandAtom()) {
+		return false;
+	}
+	msg->d->channelAtom = channel;
+	msg->d->commandAtom = command;
+	return true;
+}
+
+void MessageHub::route(const Message &msg, Deliveries *deliveries)
 {
 	qCDebug(Messages) << "routing" << msg;
 
+	// a channel might have been subscribed to after a message on it was received
+	if (msg.channelAtom() == Atom::Unknown || msg.commandAtom() == Atom::Unknown) {
+		Message resolved = msg;
+		if (resolveAtoms(&resolved)) {
+			route(resolved, deliveries);
+			return;
+		}
+	}
+
+	// O(1) lookup of the actor waiting for this reply, it does not need to be subscribed to the channel
+	AbstractActor *waiting = nullptr;
+	int finishedChannel = -1;
+	bool exclusive = false;
+	if (msg.isReply() && !m_pendingReplies.isEmpty()) {
+		// partial replies are followed by more
+		const PendingReply pending = msg.isPartialReply() ? m_pendingReplies.value(msg.replyTo()) : m_pendingReplies.take(msg.replyTo());
+		waiting = pending.actor;
+		exclusive = pending.exclusive;
+		if (waiting && !msg.isPartialReply()) {
+			forgetPendingReply(waiting, msg.replyTo());
+			finishedChannel = pending.channel;
+		}
+	}
+
 	if (msg.to()) {
-		msg.to()->receive(msg);
-	} else if (msg.channel() == "client") {
-		if (msg.command() == "reset") {
+		if (deliveries) {
+			deliver(msg.to(), msg, deliveries);
+		} else {
+			msg.to()->receive(msg);
+		}
+		if (waiting && waiting != msg.to() && m_actors.contains(waiting)) {
+			deliver(waiting, msg, deliveries);
+		}
+	} else if (msg.channelAtom() == Atom::Client) {
+		if (msg.commandAtom() == Atom::Reset) {
+			// everything routed before the reset is delivered before it
+			if (deliveries) {
+				flush(deliveries);
+			}
 			for (AbstractActor *a : m_actors) {
 				a->reset();
 			}
 		}
 	} else {
-		sendToAllActors(msg);
+		if (waiting && waiting != msg.from()) {
+			deliver(waiting, msg, deliveries);
+		}
+		// other subscribers of the channel (lists for example) still get to see the reply
+		if (!exclusive) {
+			sendToAllActors(msg, waiting, deliveries);
+		}
+	}
+
+	if (finishedChannel != -1) {
+		removeReplyInterest(finishedChannel);
 	}
 }
 
-void MessageHub::sendToAllActors(const Message &msg)
+void MessageHub::expectReply(AbstractActor *actor, const Message &msg)
+{
+	Q_ASSERT(m_actors.contains(actor));
+	const int channel = actor->m_replyInterest ? msg.channelAtom() : -1;
+	m_pendingReplies.insert(msg.id(), PendingReply{actor, channel, msg.isReply()});
+	actor->m_pendingReplies.insert(msg.id());
+	actor->m_pendingReplyOrder.enqueue(msg.id());
+	if (channel != -1) {
+		addReplyInterest(channel);
+	}
+	// requests that are never answered (a remote side sending to a channel nobody serves, for
+	// example) must not pile up, after enough newer ones they are given up on
+	while (actor->m_pendingReplyOrder.size() > AbstractActor::MaxPendingReplies) {
+		cancelReply(actor, actor->m_pendingReplyOrder.dequeue());
+	}
+}
+void MessageHub::cancelReply(AbstractActor *actor, const QUuid &id)
+{
+	if (!actor->m_pendingReplies.contains(id)) {
+		return;
+	}
+	const PendingReply pending = m_pendingReplies.take(id);
+	forgetPendingReply(actor, id);
+	if (pending.channel != -1) {
+		removeReplyInterest(pending.channel);
+	}
+}
+void MessageHub::forgetPendingReply(AbstractActor *actor, const QUuid &id)
 {
-	auto actors = [this, msg]() { return (m_subscriptions.value(msg.channel()) + m_subscriptions.value("*")).toList().toSet(); };
+	actor->m_pendingReplies.remove(id);
+	// replies mostly come in the order of the requests, so answered ids rarely stay in the queue for long
+	while (!actor->m_pendingReplyOrder.isEmpty() && !actor->m_pendingReplies.contains(actor->m_pendingReplyOrder.head())) {
+		actor->m_pendingReplyOrder.dequeue();
+	}
+}
 
-	for (AbstractActor *a : actors()) {
-		// actors might unsubscribe, or even get deleted, when handling a message, thus we double-check to make sure it's still there
-		if (actors().contains(a) && a != msg.from()) {
-			try {
-				a->receive(msg);
-			} catch (Exception &e) {
-				messageFromActor(a, msg.createErrorReply(e.cause()));
-			}
+void MessageHub::deliver(AbstractActor *actor, const Message &msg)
+{
+	try {
+		actor->receive(msg);
+	} catch (Exception &e) {
+		messageFromActor(actor, msg.createErrorReply(e.cause()));
+	}
+}
+void MessageHub::deliver(AbstractActor *actor, const Message &msg, Deliveries *deliveries)
+{
+	if (!deliveries) {
+		deliver(actor, msg);
+		return;
+	}
+	auto it = deliveries->messages.find(actor);
+	if (it == deliveries->messages.end()) {
+		deliveries->actors.append(actor);
+		it = deliveries->messages.insert(actor, QVector<Message>());
+	}
+	it.value().append(msg);
+}
+void MessageHub::deliverBatch(AbstractActor *actor, const QVector<Message> &messages)
+{
+	if (messages.size() == 1) {
+		deliver(actor, messages.first());
+		return;
+	}
+	try {
+		actor->receiveBatch(messages);
+	} catch (Exception &e) {
+		// there is no single message to reply to, see AbstractActor::receiveBatch
+		Q_ASSERT_X(false, "MessageHub::deliverBatch", "receiveBatch must not throw, exceptions need to be handled per message");
+		qCCritical(Messages) << "Exception while receiving a batch of messages, the senders get no error reply:" << e.cause();
+	}
+}
+void MessageHub::flush(Deliveries *deliveries)
+{
+	const Deliveries current = *deliveries;
+	deliveries->actors.clear();
+	deliveries->messages.clear();
+	for (AbstractActor *actor : current.actors) {
+		// actors might get deleted while others handle their messages
+		if (m_actors.contains(actor)) {
+			deliverBatch(actor, current.messages.value(actor));
+		}
+	}
+}
+
+bool MessageHub::isSubscribed(AbstractActor *actor, const int channel) const
+{
+	// the channels of the actor are a set, unlike the subscribers of a channel
+	return m_actors.contains(actor) && actor->m_channels.contains(channel);
+}
+
+void MessageHub::sendToAllActors(const Message &msg, AbstractActor *skip, Deliveries *deliveries)
+{
+	const int channel = msg.channelAtom();
+	// these are shallow copies, changes made to the subscriptions while dispatching do not affect them
+	const QVector<AbstractActor *> subscribers = m_subscriptions.value(channel);
+	const QVector<AbstractActor *> wildcards = channel == Atom::Wildcard ? QVector<AbstractActor *>() : m_subscriptions.value(Atom::Wildcard);
+	const quint64 generation = m_generation;
+
+	auto deliverIfSubscribed = [this, &msg, skip, generation, deliveries](AbstractActor *a, const int subscribedTo) {
+		// actors might unsubscribe, or even get deleted, when handling a message, thus we double-check to make sure
+		// it's still there, but only if anything has changed since we started
+		if (a == msg.from() || a == skip || (m_generation != generation && !isSubscribed(a, subscribedTo))) {
+			return;
+		}
+		deliver(a, msg, deliveries);
+	};
+
+	for (AbstractActor *a : subscribers) {
+		deliverIfSubscribed(a, channel);
+	}
+	for (AbstractActor *a : wildcards) {
+		// subscribers of the channel already got it. there can be many of both (every connection is a
+		// wildcard subscriber until it knows the interest of its client), so this is looked up in the
+		// channels of the actor, which may only be touched while it is registered
+		if (!m_actors.contains(a) || !a->m_channels.contains(channel)) {
+			deliverIfSubscribed(a, Atom::Wildcard);
 		}
 	}
 }
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <QHash>
+#include <QQueue>
 #include <QSet>
+#include <QVector>
+#include <QUuid>
 #include <QLoggingCategory>
 
+#include "Message.h"
+
 class AbstractActor;
 class AbstractExternalActor;
-class Message;
 
 class MessageHub
 {
@@ -17,23 +21,96 @@ public:
 	void registerActor(AbstractActor *actor);
 	void unregisterActor(AbstractActor *actor);
 
+	/// how messages sent by actors are delivered
+	enum DispatchMode
+	{
+		/// delivered before send returns, messages sent while receiving are delivered recursively
+		ImmediateDispatch,
+		/// added to a FIFO run queue that the outermost send drains, one round of everything queued
+		/// at a time, with each actor getting its messages of a round through AbstractActor::receiveBatch
+		QueuedDispatch
+	};
+	DispatchMode dispatchMode() const { return m_dispatchMode; }
+	/// @warning with QueuedDispatch nothing sent from within a delivery is delivered before the delivery
+	///          returns, so waiting for a reply there (Request::sendAndWait, a nested event loop) never ends
+	void setDispatchMode(const DispatchMode mode) { m_dispatchMode = mode; }
+	/// if the hub is in the middle of delivering queued messages, see QueuedDispatch
+	bool isDraining() const { return m_draining; }
+
 	QSet<AbstractActor *> actors() const { return m_actors; }
+	/// atoms of all channels that have at least one subscriber, or an actor waiting for a reply on them
+	QSet<int> channels() const;
 
 private:
 	friend class AbstractActor;
 	friend class AbstractExternalActor;
 	/// @see AbstractActor::subscribeTo
-	void subscribeActorTo(AbstractActor *actor, const QString &channel);
+	void subscribeActorTo(AbstractActor *actor, const int channel);
 	/// @see AbstractActor::unsubscribeFrom
-	void unsubscribeActorFrom(AbstractActor *actor, const QString &channel);
+	void unsubscribeActorFrom(AbstractActor *actor, const int channel);
 	/// @see AbstractActor::send
 	void messageFromActor(AbstractActor *actor, const Message &message);
+	/// routes all messages before delivering any, so that each actor gets its share in one AbstractActor::receiveBatch
+	/// @see AbstractActor::sendBatch
+	void messagesFromActor(AbstractActor *actor, const QVector<Message> &messages);
+	/// the next reply to the given message id is delivered directly to the actor, even if it is not subscribed to its channel
+	/// @note if msg is a reply itself the replies to it go to the actor only, not to the subscribers of the channel
+	/// @see AbstractActor::expectsReplyTo
+	void expectReply(AbstractActor *actor, const Message &msg);
+	/// @see AbstractActor::cancelReply
+	void cancelReply(AbstractActor *actor, const QUuid &id);
 
 private:
-	QHash<QString, QSet<AbstractActor *>> m_subscriptions;
+	/// channel atom -> subscribed actors
+	/// @note the vectors are implicitly shared, so sendToAllActors can iterate a snapshot without copying
+	QHash<int, QVector<AbstractActor *>> m_subscriptions;
 	QSet<AbstractActor *> m_actors;
+	struct PendingReply
+	{
+		AbstractActor *actor = nullptr;
+		/// the channel the reply is expected on, or -1 if it does not count towards the interest in it
+		int channel = -1;
+		/// replies to replies (index:credit for example) are of no interest to anyone else
+		bool exclusive = false;
+	};
+	/// message id -> actor waiting for a reply to it
+	QHash<QUuid, PendingReply> m_pendingReplies;
+	/// channel atom -> number of replies expected on it, see AbstractActor::m_replyInterest
+	/// @note replies from remote hubs only reach us if we announce interest in their channel
+	QHash<int, int> m_replyChannels;
+	void addReplyInterest(const int channel);
+	/// removes the id from the pending replies of the actor, after its entry in m_pendingReplies is gone
+	void forgetPendingReply(AbstractActor *actor, const QUuid &id);
+	void removeReplyInterest(const int channel);
+	/// incremented whenever an actor is unregistered or its subscriptions change
+	quint64 m_generation = 0;
+
+	DispatchMode m_dispatchMode = ImmediateDispatch;
+	/// messages not yet routed, see QueuedDispatch
+	QQueue<Message> m_runQueue;
+	bool m_draining = false;
+	void drain();
+	/// a notification from the hub itself to all subscribers of its channel
+	void notify(const Message &msg);
+
+	/// messages that have been routed but not yet delivered
+	struct Deliveries
+	{
+		/// in the order in which they were first given a message
+		QVector<AbstractActor *> actors;
+		QHash<AbstractActor *, QVector<Message>> messages;
+	};
 
-	void sendToAllActors(const Message &msg);
+	bool isSubscribed(AbstractActor *actor, const int channel) const;
+	/// updates atoms of the message that were unknown when it was received, returns false if there are none
+	static bool resolveAtoms(Message *msg);
+	/// delivers right away if deliveries is null, otherwise adds to it
+	void route(const Message &msg, Deliveries *deliveries);
+	void deliver(AbstractActor *actor, const Message &msg);
+	void deliver(AbstractActor *actor, const Message &msg, Deliveries *deliveries);
+	void deliverBatch(AbstractActor *actor, const QVector<Message> &messages);
+	void flush(Deliveries *deliveries);
+	void sendToAllActors(const Message &msg, AbstractActor *skip = nullptr, Deliveries *deliveries = nullptr);
 };
 
 Q_DECLARE_LOGGING_CATEGORY(Messages)
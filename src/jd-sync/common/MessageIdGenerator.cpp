@@ -0,0 +1,45 @@
+#include "MessageIdGenerator.h"
+
+#include <QAtomicPointer>
+
+namespace
+{
+QBasicAtomicPointer<MessageIdGenerator> customInstance = Q_BASIC_ATOMIC_INITIALIZER(nullptr);
+
+MessageIdGenerator *defaultInstance()
+{
+	static CountingMessageIdGenerator generator;
+	return &generator;
+}
+}
+
+MessageIdGenerator::~MessageIdGenerator() {}
+
+MessageIdGenerator *MessageIdGenerator::instance()
+{
+	MessageIdGenerator *generator = customInstance.loadAcquire();
+	return generator ? generator : defaultInstance();
+}
+void MessageIdGenerator::setInstance(MessageIdGenerator *generator)
+{
+	customInstance.storeRelease(generator);
+}
+
+CountingMessageIdGenerator::CountingMessageIdGenerator()
+	: m_prefix(QUuid::createUuid()), m_counter(0) {}
+
+QUuid CountingMessageIdGenerator::next()
+{
+	const quint64 count = m_counter.fetchAndAddRelaxed(1);
+	QUuid uuid = m_prefix;
+	// data4[0] holds the variant bits, the remaining 7 bytes hold the counter
+	for (int i = 7; i >= 1; --i) {
+		uuid.data4[i] = uchar(count >> (8 * (7 - i)));
+	}
+	return uuid;
+}
+
+QUuid RandomMessageIdGenerator::next()
+{
+	return QUuid::createUuid();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QUuid>
+#include <QAtomicInteger>
+
+/// Source of the ids of newly created messages
+///
+/// Message ids only need to be unique, not unpredictable, so the default generator avoids going to
+/// the system random number generator for every message.
+class MessageIdGenerator
+{
+public:
+	virtual ~MessageIdGenerator();
+
+	/// thread-safe
+	virtual QUuid next() = 0;
+
+	/// the generator used for new messages, never null
+	static MessageIdGenerator *instance();
+	/// replaces the generator used for new messages, or restores the default if null
+	/// @note the generator is not taken ownership of and needs to outlive all users
+	static void setInstance(MessageIdGenerator *generator);
+};
+
+/// Default generator: a random per-generator prefix followed by a 56 bit counter
+///
+/// The prefix keeps 66 random bits, which keeps ids unique across processes, and the result is still
+/// a valid version 4 UUID.
+class CountingMessageIdGenerator : public MessageIdGenerator
+{
+public:
+	explicit CountingMessageIdGenerator();
+
+	QUuid next() override;
+
+private:
+	QUuid m_prefix;
+	QAtomicInteger<quint64> m_counter;
+};
+
+/// Generates fully random ids using QUuid::createUuid
+class RandomMessageIdGenerator : public MessageIdGenerator
+{
+public:
+	QUuid next() override;
+};
@@ -0,0 +1,96 @@
+#include "MessageMailbox.h"
+
+#include <QThread>
+
+static quint64 nextPowerOfTwo(const int value)
+{
+	quint64 result = 2;
+	while (result < quint64(value)) {
+		result <<= 1;
+	}
+	return result;
+}
+
+MessageMailbox::MessageMailbox(const std::function<void()> &wakeup, const int capacity)
+	: m_wakeup(wakeup), m_cells(new Cell[nextPowerOfTwo(capacity)]), m_mask(nextPowerOfTwo(capacity) - 1), m_enqueuePos(0)
+{
+	for (quint64 i = 0; i <= m_mask; ++i) {
+		m_cells[i].sequence.store(i);
+	}
+}
+MessageMailbox::~MessageMailbox() {}
+
+void MessageMailbox::push(const Message &msg)
+{
+	if (m_overflowing.loadAcquire() || !tryPush(msg)) {
+		QMutexLocker locker(&m_overflowLock);
+		m_overflow.append(msg);
+		m_overflowing.storeRelease(1);
+	}
+
+	if (m_scheduled.testAndSetOrdered(0, 1)) {
+		m_wakeup();
+	}
+}
+
+void MessageMailbox::takeAll(QVector<Message> *out)
+{
+	// anything pushed from now on needs a new wakeup
+	m_scheduled.storeRelease(0);
+
+	Message msg;
+	while (tryPop(&msg)) {
+		out->append(std::move(msg));
+	}
+
+	if (m_overflowing.loadAcquire()) {
+		QMutexLocker locker(&m_overflowLock);
+		// messages that were claimed in the ring before it overflowed need to come first. no new
+		// slots are claimed while m_overflowing is set, so this only waits for pushes in progress.
+		while (m_dequeuePos != m_enqueuePos.loadAcquire()) {
+			if (tryPop(&msg)) {
+				out->append(std::move(msg));
+			} else {
+				QThread::yieldCurrentThread();
+			}
+		}
+		out->append(m_overflow);
+		m_overflow.clear();
+		m_overflowing.storeRelease(0);
+	}
+}
+
+bool MessageMailbox::tryPush(const Message &msg)
+{
+	quint64 pos = m_enqueuePos.load();
+	Cell *cell;
+	forever {
+		cell = &m_cells[pos & m_mask];
+		const quint64 sequence = cell->sequence.loadAcquire();
+		const qint64 diff = qint64(sequence - pos);
+		if (diff == 0) {
+			if (m_enqueuePos.testAndSetRelaxed(pos, pos + 1, pos)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false; // full
+		} else {
+			pos = m_enqueuePos.load();
+		}
+	}
+	cell->message = msg;
+	cell->sequence.storeRelease(pos + 1);
+	return true;
+}
+bool MessageMailbox::tryPop(Message *msg)
+{
+	Cell &cell = m_cells[m_dequeuePos & m_mask];
+	const quint64 sequence = cell.sequence.loadAcquire();
+	if (qint64(sequence - (m_dequeuePos + 1)) < 0) {
+		return false; // empty, or the producer has not finished writing yet
+	}
+	*msg = std::move(cell.message);
+	cell.sequence.storeRelease(m_dequeuePos + m_mask + 1);
+	++m_dequeuePos;
+	return true;
+}
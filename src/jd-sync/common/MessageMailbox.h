@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QVector>
+#include <functional>
+#include <memory>
+
+#include "Message.h"
+
+/// Multi-producer, single-consumer queue of messages for passing them between threads
+///
+/// Messages are stored in a bounded lock-free ring buffer (Vyukov's bounded queue). Only if the ring
+/// is full do producers fall back to a mutex-protected overflow queue. The order of messages from a
+/// single producer is always kept.
+///
+/// The consumer is woken up once per batch: the wakeup function is only called by the push that
+/// finds the mailbox idle, further pushes are picked up by the same takeAll().
+class MessageMailbox
+{
+public:
+	/// @param capacity size of the ring buffer, rounded up to a power of two. it is allocated up
+	///                 front for every actor, bursts that do not fit go to the overflow queue
+	explicit MessageMailbox(const std::function<void()> &wakeup, const int capacity = 32);
+	~MessageMailbox();
+
+	/// thread-safe
+	void push(const Message &msg);
+	/// appends all queued messages to out, must only be called from the consumer
+	void takeAll(QVector<Message> *out);
+
+private:
+	Q_DISABLE_COPY(MessageMailbox)
+
+	struct Cell
+	{
+		QAtomicInteger<quint64> sequence;
+		Message message;
+	};
+
+	std::function<void()> m_wakeup;
+	std::unique_ptr<Cell[]> m_cells;
+	const quint64 m_mask;
+	QAtomicInteger<quint64> m_enqueuePos;
+	quint64 m_dequeuePos = 0; // only touched by the consumer
+
+	/// set while the ring has overflowed, forcing producers to the overflow queue to keep the order
+	QAtomicInt m_overflowing;
+	QMutex m_overflowLock;
+	QVector<Message> m_overflow;
+
+	/// set from the first push after a takeAll() until the next takeAll()
+	QAtomicInt m_scheduled;
+
+	bool tryPush(const Message &msg);
+	bool tryPop(Message *msg);
+};
@@ -0,0 +1,130 @@
+#include "OutboundQueue.h"
+
+#include <QJsonArray>
+#include <QStringList>
+
+#include <jd-util/Json.h>
+
+#include "Atom.h"
+#include "CRUDMessages.h"
+#include "StringDelta.h"
+
+OutboundQueue::OutboundQueue(const Limits &limits, Metrics *metrics)
+	: m_limits(limits), m_metrics(metrics) {}
+
+OutboundQueue::~OutboundQueue()
+{
+	clear();
+}
+
+int OutboundQueue::enqueue(const Message &msg, const int bytes, const bool conflatable)
+{
+	const QString key = m_limits.conflate && conflatable ? conflationKey(msg) : QString();
+	if (!key.isNull()) {
+		const auto it = m_keyPositions.constFind(key);
+		if (it != m_keyPositions.constEnd()) {
+			// replace in place, so the message keeps the position of the first unsent update
+			Entry &entry = m_entries[int(it.value() - m_headPosition)];
+			const int difference = bytes - entry.bytes;
+			entry.message = msg;
+			entry.bytes = bytes;
+			m_bytes += difference;
+			++m_conflated;
+			if (m_metrics) {
+				m_metrics->queuedBytes.fetchAndAddRelaxed(difference);
+				m_metrics->conflatedMessages.fetchAndAddRelaxed(1);
+			}
+			m_peakBytes = qMax(m_peakBytes, m_bytes);
+			return 0;
+		}
+		m_keyPositions.insert(key, m_headPosition + quint64(m_entries.size()));
+	}
+
+	m_entries.enqueue(Entry{msg, bytes, key});
+	m_bytes += bytes;
+	if (m_metrics) {
+		m_metrics->queuedMessages.fetchAndAddRelaxed(1);
+		m_metrics->queuedBytes.fetchAndAddRelaxed(bytes);
+	}
+
+	// the new message is always kept, even if it exceeds the limits on its own
+	const auto overLimits = [this]() {
+		if (m_limits.policy == Block) {
+			return m_bytes > m_limits.hardMaxBytes;
+		}
+		return m_entries.size() > m_limits.maxMessages || m_bytes > m_limits.maxBytes;
+	};
+	int dropped = 0;
+	while (m_entries.size() > 1 && overLimits()) {
+		take();
+		++dropped;
+	}
+	m_dropped += dropped;
+	if (m_metrics && dropped > 0) {
+		m_metrics->droppedMessages.fetchAndAddRelaxed(dropped);
+	}
+
+	m_peakSize = qMax(m_peakSize, m_entries.size());
+	m_peakBytes = qMax(m_peakBytes, m_bytes);
+	return dropped;
+}
+
+Message OutboundQueue::dequeue()
+{
+	return take().message;
+}
+
+void OutboundQueue::clear()
+{
+	if (m_metrics) {
+		m_metrics->queuedMessages.fetchAndAddRelaxed(-m_entries.size());
+		m_metrics->queuedBytes.fetchAndAddRelaxed(-m_bytes);
+	}
+	m_headPosition += quint64(m_entries.size());
+	m_entries.clear();
+	m_keyPositions.clear();
+	m_bytes = 0;
+}
+
+QString OutboundQueue::conflationKey(const Message &msg)
+{
+	QString key;
+	if (!msg.conflationKey().isEmpty()) {
+		key = msg.conflationKey();
+	} else if (msg.isUpdateReply()) {
+		const UpdateReplyMessage reply = msg.toUpdateReply();
+		if (reply.items().size() != 1) {
+			return QString();
+		}
+		const QJsonObject item = reply.items().at(0);
+		// a delta is based on the previous update, which is gone once it has been replaced
+		if (!item.contains("id") || StringDelta::containsDelta(item)) {
+			return QString();
+		}
+		// replacing is only fine if the newer update contains everything the older one did
+		key = reply.table() + QLatin1Char('\x1f') + Json::toText(QJsonArray({item.value("id")})) + QLatin1Char('\x1f') + QStringList(item.keys()).join(QLatin1Char(','));
+	} else {
+		return QString();
+	}
+	// unknown names are spelled out, prefixed by their length so that they can not be mistaken for an atom
+	const auto name = [](const int atom, const QString &string) {
+		return atom != Atom::Unknown ? QString::number(atom) : QLatin1Char('"') + QString::number(string.size()) + QLatin1Char('"') + string;
+	};
+	return name(msg.channelAtom(), msg.channel()) + QLatin1Char(':') + name(msg.commandAtom(), msg.command()) + QLatin1Char(':') + key;
+}
+
+OutboundQueue::Entry OutboundQueue::take()
+{
+	Q_ASSERT_X(!m_entries.isEmpty(), "OutboundQueue::take", "queue is empty");
+	const Entry entry = m_entries.dequeue();
+	if (!entry.key.isNull()) {
+		m_keyPositions.remove(entry.key);
+	}
+	++m_headPosition;
+	m_bytes -= entry.bytes;
+	if (m_metrics) {
+		m_metrics->queuedMessages.fetchAndAddRelaxed(-1);
+		m_metrics->queuedBytes.fetchAndAddRelaxed(-entry.bytes);
+	}
+	return entry;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QHash>
+#include <QQueue>
+
+#include "Message.h"
+
+/// Messages waiting to be written to a connection, bounded in number and size
+///
+/// Once the limits are reached the owner reacts according to the policy, it checks isFull() (and
+/// the number of dropped messages) after enqueuing. The queue itself never grows past its limits,
+/// the oldest messages are discarded to make room, except with the Block policy: messages keep
+/// being queued while reading is blocked, up to a hard limit of hardMaxBytes.
+///
+/// With conflation enabled a message that carries the latest state of something replaces a queued
+/// message for the same thing in place, so that a slow consumer does not get a backlog of stale
+/// intermediate values. See conflationKey() for which messages this applies to.
+class OutboundQueue
+{
+public:
+	enum Policy
+	{
+		Block, ///< stop reading from the remote side until the queue has drained, which only holds back replies to it, nothing is dropped below hardMaxBytes
+		DropOldest, ///< discard the oldest messages to make room
+		Disconnect ///< close the connection
+	};
+	struct Limits
+	{
+		int maxMessages = 10000;
+		qint64 maxBytes = 16 * 1024 * 1024;
+		/// with the Block policy, the size up to which messages are kept anyway
+		qint64 hardMaxBytes = 64 * 1024 * 1024;
+		Policy policy = DropOldest;
+		bool conflate = true;
+	};
+	/// totals of all queues sharing it, may be read from any thread
+	struct Metrics
+	{
+		QAtomicInteger<qint64> queuedMessages;
+		QAtomicInteger<qint64> queuedBytes;
+		QAtomicInteger<qint64> droppedMessages;
+		QAtomicInteger<qint64> conflatedMessages;
+		/// connections that currently have a full queue
+		QAtomicInteger<int> slowConsumers;
+		QAtomicInteger<qint64> disconnectedConsumers;
+	};
+
+	explicit OutboundQueue(const Limits &limits = Limits(), Metrics *metrics = nullptr);
+	~OutboundQueue();
+
+	const Limits &limits() const { return m_limits; }
+	void setLimits(const Limits &limits) { m_limits = limits; }
+
+	/// @param bytes the encoded size of the message
+	/// @param conflatable false for messages that need to be delivered as they are, for example
+	///                    replies the remote side is waiting for
+	/// @returns the number of messages that had to be dropped to make room, with the Block policy only
+	///          once hardMaxBytes have been reached
+	int enqueue(const Message &msg, const int bytes, const bool conflatable = true);
+	Message dequeue();
+	void clear();
+
+	bool isEmpty() const { return m_entries.isEmpty(); }
+	int size() const { return m_entries.size(); }
+	qint64 bytes() const { return m_bytes; }
+	/// if one of the limits (not the hard limit) has been reached
+	bool isFull() const { return m_entries.size() >= m_limits.maxMessages || m_bytes >= m_limits.maxBytes; }
+	/// if the queue has drained to half of the limits, used as the point to recover from being full
+	bool isBelowLowWater() const { return m_entries.size() <= m_limits.maxMessages / 2 && m_bytes <= m_limits.maxBytes / 2; }
+
+	int peakSize() const { return m_peakSize; }
+	qint64 peakBytes() const { return m_peakBytes; }
+	qint64 dropped() const { return m_dropped; }
+	qint64 conflated() const { return m_conflated; }
+
+	/// the key by which msg supersedes earlier messages, or a null string if it does not
+	///
+	/// Uses the key set by the producer (Message::setConflationKey) if there is one. Otherwise
+	/// update:result messages for a single record are keyed by table, record id and the
+	/// properties they contain, unless they contain deltas (see StringDelta).
+	static QString conflationKey(const Message &msg);
+
+private:
+	Q_DISABLE_COPY(OutboundQueue)
+
+	struct Entry
+	{
+		Message message;
+		int bytes;
+		QString key;
+	};
+
+	Limits m_limits;
+	Metrics *m_metrics;
+	QQueue<Entry> m_entries;
+	qint64 m_bytes = 0;
+	/// position of the head in the sequence of all messages ever enqueued
+	quint64 m_headPosition = 0;
+	/// position of the queued message for each conflation key
+	QHash<QString, quint64> m_keyPositions;
+
+	int m_peakSize = 0;
+	qint64 m_peakBytes = 0;
+	qint64 m_dropped = 0;
+	qint64 m_conflated = 0;
+
+	Entry take();
+};
@@ -5,6 +5,8 @@
 #include <jd-util/Exception.h>
 
 #include "RequestWaiter.h"
+#include "MessageHub.h"
+#include "Atom.h"
 
 class TimeoutTimer : public QTimer
 {
@@ -16,7 +18,7 @@ public:
 		{
 			if (request->m_retriesOnTimeout > 0) {
 				--request->m_retriesOnTimeout;
-				request->m_message = request->m_message.createCopy();
+				request->renewMessage();
 				if (request->m_timeout) {
 					request->m_timeout();
 				}
@@ -92,7 +94,8 @@ Request &Request::deleteOnFinished()
 
 Request &Request::send()
 {
-	subscribeTo(m_message.channel());
+	// no need to subscribe to the channel, the hub routes the reply directly to us
+	m_sent = true;
 
 	if (m_timeoutSecs != -1) {
 		if (m_timer) {
@@ -109,6 +112,7 @@ Request &Request::send()
 
 void Request::sendAndWait()
 {
+	Q_ASSERT_X(!hub()->isDraining(), "Request::sendAndWait", "the reply can not be delivered while waiting inside a queued delivery");
 	send();
 	if (!m_done) {
 		RequestWaiter::wait(this);
@@ -122,18 +126,23 @@ Request &Request::create(MessageHub *hub, const Message &msg)
 
 void Request::receive(const Message &message)
 {
-	if (!message.isReply() || message.channel() != m_message.channel() || message.replyTo() != m_message.id()) {
+	if (!message.isReply() || message.replyTo() != m_message.id()
+			|| !Atom::sameName(message.channelAtom(), message.channel(), m_message.channelAtom(), m_message.channel())) {
 		return;
 	}
 
-	if (m_timer) {
+	// a streamed reply keeps the request alive until its last part
+	const bool partial = message.isPartialReply();
+	if (m_timer && partial) {
+		m_timer->start();
+	} else if (m_timer) {
 		delete m_timer;
 		m_timer = nullptr;
 	}
 
 	std::exception_ptr exception;
 	try {
-		if (message.command() == "error" && m_error) {
+		if (message.isError() && m_error) {
 			m_error(message.toError());
 		} else if (m_then) {
 			m_then(message);
@@ -142,7 +151,9 @@ void Request::receive(const Message &message)
 		exception = std::current_exception();
 	}
 
-	unsubscribeFrom(m_message.channel());
+	if (partial && !exception) {
+		return;
+	}
 
 	if (m_waiter && !exception) {
 		m_waiter->notifyDone(this);
@@ -161,20 +172,36 @@ void Request::receive(const Message &message)
 void Request::reset()
 {
 	// if the message was already sent we resend it upon a reset
-	if (channels().contains(m_message.channel())) {
-		m_message = m_message.createCopy();
+	if (m_sent && !m_done) {
+		renewMessage();
 		send();
 	}
 }
+void Request::renewMessage()
+{
+	// late replies to the previous attempt are not of interest anymore
+	cancelReply(m_message.id());
+	m_message = m_message.createCopy();
+}
+bool Request::expectsReplyTo(const Message &msg) const
+{
+	return msg.id() == m_message.id();
+}
 
 RequestObject::RequestObject(MessageHub *hub, const Message &message, QObject *parent)
 	: QObject(parent), m_request(std::make_unique<Request>(hub, message))
 {
-	m_request->then([this](const Message &msg) { emit reply(msg); deleteLater(); });
+	m_request->then([this](const Message &msg) {
+		emit reply(msg);
+		// the parts of a streamed reply are all emitted, only the last one finishes the request
+		if (!msg.isPartialReply()) {
+			emit finished();
+			deleteLater();
+		}
+	});
 	m_request->error([this](const Message &msg) { emit error(msg); deleteLater(); });
 	m_request->timeout([this]() { emit timeout(); deleteLater(); });
 
-	connect(this, &RequestObject::reply, &RequestObject::finished);
 	connect(this, &RequestObject::error, &RequestObject::finished);
 	connect(this, &RequestObject::timeout, &RequestObject::finished);
 }
@@ -46,13 +46,18 @@ private:
 	int m_retriesOnTimeout = 0;
 	bool m_deleteOnFinish = false;
 	TimeoutTimer *m_timer = nullptr;
+	bool m_sent = false;
 	bool m_done = false;
 
 	friend class RequestWaiter;
 	RequestWaiter *m_waiter = nullptr;
 
+	/// gives the message a new id for sending it again
+	void renewMessage();
+
 	void receive(const Message &message) override;
 	void reset() override;
+	bool expectsReplyTo(const Message &msg) const override;
 };
 
 class RequestObject : public QObject
@@ -65,6 +70,7 @@ public slots:
 	void send();
 
 signals:
+	/// emitted for every part of a streamed reply
 	void reply(const Message &msg);
 	void error(const Message &msg);
 	void timeout();
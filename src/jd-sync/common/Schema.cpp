@@ -0,0 +1,68 @@
+#include "Schema.h"
+
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QQueue>
+
+namespace
+{
+// remote sides can announce as many schemas as they like, so the registry is bounded. requests
+// referring to a forgotten schema get replies with column names, like for any unknown schema
+QMutex &registryLock()
+{
+	static QMutex lock;
+	return lock;
+}
+QHash<QString, Schema> &registry()
+{
+	static QHash<QString, Schema> schemas;
+	return schemas;
+}
+/// fingerprints in the order they were registered
+QQueue<QString> &registrationOrder()
+{
+	static QQueue<QString> order;
+	return order;
+}
+}
+
+Schema::Schema(const QVector<QString> &columns)
+	: m_columns(columns), m_fingerprint(columns.isEmpty() ? QString() : fingerprint(columns))
+{
+	m_ordinals.reserve(columns.size());
+	for (int i = 0; i < columns.size(); ++i) {
+		m_ordinals.insert(columns.at(i), i);
+	}
+}
+
+QString Schema::fingerprint(const QVector<QString> &columns)
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	for (const QString &column : columns) {
+		hash.addData(column.toUtf8());
+		hash.addData("\n", 1);
+	}
+	// 64 bits are plenty to tell apart the schemas of a single application
+	return QString::fromLatin1(hash.result().left(8).toHex());
+}
+
+void Schema::registerSchema(const Schema &schema)
+{
+	if (schema.isNull()) {
+		return;
+	}
+	QMutexLocker locker(&registryLock());
+	if (registry().contains(schema.fingerprint())) {
+		return;
+	}
+	while (registry().size() >= MaxRegistered) {
+		registry().remove(registrationOrder().dequeue());
+	}
+	registry().insert(schema.fingerprint(), schema);
+	registrationOrder().enqueue(schema.fingerprint());
+}
+Schema Schema::registered(const QString &fingerprint)
+{
+	QMutexLocker locker(&registryLock());
+	return registry().value(fingerprint);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+/// An ordered list of columns, identified by a fingerprint of their names
+///
+/// Once both sides of a channel know a schema, the columnar layout of CRUD items can refer to
+/// columns by their ordinal in it instead of by name (see JsonObjectRange). The receiver can then
+/// look up everything it needs about a column by index.
+class Schema
+{
+public:
+	explicit Schema(const QVector<QString> &columns = QVector<QString>());
+
+	bool isNull() const { return m_columns.isEmpty(); }
+	QString fingerprint() const { return m_fingerprint; }
+	QVector<QString> columns() const { return m_columns; }
+	/// the ordinal of a column, or -1 if it is not part of the schema
+	int ordinal(const QString &column) const { return m_ordinals.value(column, -1); }
+
+	static QString fingerprint(const QVector<QString> &columns);
+
+	/// at most this many schemas are known at a time, the ones registered first are forgotten first
+	enum
+	{
+		MaxRegistered = 1024
+	};
+
+	/// makes the schema known under its fingerprint, thread-safe
+	static void registerSchema(const Schema &schema);
+	/// a previously registered schema, or a null schema if it is unknown, thread-safe
+	static Schema registered(const QString &fingerprint);
+
+private:
+	QVector<QString> m_columns;
+	QHash<QString, int> m_ordinals;
+	QString m_fingerprint;
+};
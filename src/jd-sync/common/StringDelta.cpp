@@ -0,0 +1,109 @@
+#include "StringDelta.h"
+
+#include <QCryptographicHash>
+
+#include <jd-util/Json.h>
+#include <jd-util/Exception.h>
+
+QJsonValue StringDelta::create(const QJsonValue &base, const QJsonValue &value)
+{
+	if (!base.isString() || !value.isString()) {
+		return value;
+	}
+	const QString from = base.toString();
+	const QString to = value.toString();
+	if (to.size() < MinimumSize || from.size() < MinimumSize) {
+		return value;
+	}
+
+	const int maxCommon = qMin(from.size(), to.size());
+	int prefix = 0;
+	while (prefix < maxCommon && from.at(prefix) == to.at(prefix)) {
+		++prefix;
+	}
+	int suffix = 0;
+	while (suffix < maxCommon - prefix && from.at(from.size() - 1 - suffix) == to.at(to.size() - 1 - suffix)) {
+		++suffix;
+	}
+	// don't split surrogate pairs, the text in between needs to be valid on its own
+	if (prefix > 0 && to.at(prefix - 1).isHighSurrogate()) {
+		--prefix;
+	}
+	if (suffix > 0 && to.at(to.size() - suffix).isLowSurrogate()) {
+		--suffix;
+	}
+
+	const QString insert = to.mid(prefix, to.size() - prefix - suffix);
+	// the hashes and keys take about 100 bytes, below that a delta is not worth it
+	if (insert.size() + 100 >= to.size()) {
+		return value;
+	}
+	return QJsonObject({{"$delta", QJsonObject({{"base", hash(from)},
+												{"result", hash(to)},
+												{"prefix", prefix},
+												{"suffix", suffix},
+												{"insert", insert}})}});
+}
+bool StringDelta::isDelta(const QJsonValue &value)
+{
+	return value.isObject() && value.toObject().contains("$delta");
+}
+bool StringDelta::isApplied(const QJsonValue &current, const QJsonValue &value)
+{
+	return isDelta(value) && current.isString()
+			&& value.toObject().value("$delta").toObject().value("result").toString() == hash(current.toString());
+}
+QJsonValue StringDelta::apply(const QJsonValue &current, const QJsonValue &delta)
+{
+	const QJsonObject obj = Json::ensureObject(Json::ensureObject(delta), "$delta");
+	if (!current.isString() || Json::ensureString(obj, "base") != hash(current.toString())) {
+		throw Exception("Delta does not apply to the current value");
+	}
+	const QString base = current.toString();
+	const int prefix = Json::ensureInteger(obj, "prefix");
+	const int suffix = Json::ensureInteger(obj, "suffix");
+	if (prefix < 0 || suffix < 0 || prefix + suffix > base.size()) {
+		throw Exception("Invalid delta: out of range");
+	}
+	const QString result = base.left(prefix) + Json::ensureString(obj, "insert") + base.right(suffix);
+	if (hash(result) != Json::ensureString(obj, "result")) {
+		throw Exception("Invalid delta: unexpected result");
+	}
+	return result;
+}
+
+QJsonObject StringDelta::createAll(const QJsonObject &previous, const QJsonObject &item)
+{
+	QJsonObject out = item;
+	for (auto it = out.begin(); it != out.end(); ++it) {
+		if (previous.contains(it.key())) {
+			it.value() = create(previous.value(it.key()), it.value());
+		}
+	}
+	return out;
+}
+bool StringDelta::containsDelta(const QJsonObject &item)
+{
+	for (const QJsonValue &value : item) {
+		if (isDelta(value)) {
+			return true;
+		}
+	}
+	return false;
+}
+QJsonObject StringDelta::resolve(const QJsonObject &current, const QJsonObject &item)
+{
+	QJsonObject out = item;
+	for (auto it = out.begin(); it != out.end(); ++it) {
+		if (isDelta(it.value())) {
+			const QJsonValue base = current.value(it.key());
+			it.value() = isApplied(base, it.value()) ? base : apply(base, it.value());
+		}
+	}
+	return out;
+}
+
+QString StringDelta::hash(const QString &value)
+{
+	return QString::fromLatin1(QCryptographicHash::hash(value.toUtf8(), QCryptographicHash::Sha1).left(8).toHex());
+}
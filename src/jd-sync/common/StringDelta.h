@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QString>
+
+/// Sends changes to large string values as the part that changed instead of the full value
+///
+/// A delta replaces a value in the items of an update message with {"$delta": {...}}, holding the
+/// unchanged prefix and suffix lengths (in UTF-16 code units), the text in between and hashes of the
+/// value it is based on and of the result. The sender uses the last version it knows the receiver
+/// has as the base, and the base hash tells the receiver if that is the case. Receivers that can not
+/// apply a delta need to get the full value another way (an error reply or reading the record).
+class StringDelta
+{
+public:
+	/// values shorter than this are always sent in full
+	enum
+	{
+		MinimumSize = 1024
+	};
+
+	/// a delta from base to value, or value itself if a delta would not be worth it
+	static QJsonValue create(const QJsonValue &base, const QJsonValue &value);
+	static bool isDelta(const QJsonValue &value);
+	/// if value is a delta that has already been applied to current
+	static bool isApplied(const QJsonValue &current, const QJsonValue &value);
+	/// @throws Exception if current is not the base of the delta
+	static QJsonValue apply(const QJsonValue &current, const QJsonValue &delta);
+
+	/// creates deltas for all values of item that have a base in previous
+	static QJsonObject createAll(const QJsonObject &previous, const QJsonObject &item);
+	static bool containsDelta(const QJsonObject &item);
+	/// replaces all deltas of item by the full values, using the values of current as their base
+	/// @throws Exception if a delta can not be applied
+	static QJsonObject resolve(const QJsonObject &current, const QJsonObject &item);
+
+	static QString hash(const QString &value);
+};
@@ -2,13 +2,28 @@
 
 #include <QTcpSocket>
 #include <QDataStream>
+#include <QIODevice>
+#include <QtEndian>
+
+#include <jd-util/Exception.h>
+
+/// set in the size of compressed frames, sizes never get anywhere close to it
+static const quint32 CompressedFlag = 0x80000000u;
+
+static void appendFrame(QByteArray *buffer, const QByteArray &data, const bool compressed = false)
+{
+	uchar size[sizeof(quint32)];
+	qToLittleEndian<quint32>(quint32(data.size()) | (compressed ? CompressedFlag : 0u), size);
+	buffer->append(reinterpret_cast<const char *>(size), sizeof(size));
+	buffer->append(data);
+}
 
 void TcpUtils::writePacket(QTcpSocket *socket, const QByteArray &data)
 {
-	QDataStream str(socket);
-	str.setByteOrder(QDataStream::LittleEndian);
-	str << quint32(data.size());
-	socket->write(data);
+	QByteArray packet;
+	packet.reserve(int(sizeof(quint32)) + data.size());
+	appendFrame(&packet, data);
+	socket->write(packet);
 }
 QByteArray TcpUtils::readPacket(QTcpSocket *socket)
 {
@@ -29,3 +44,137 @@ QByteArray TcpUtils::readPacket(QTcpSocket *socket)
 
 	return socket->read(size);
 }
+
+TcpUtils::FrameReader::FrameReader(const int maxFrameSize)
+	: m_maxFrameSize(maxFrameSize) {}
+
+void TcpUtils::FrameReader::readFrom(QIODevice *device)
+{
+	compact();
+
+	const qint64 available = device->bytesAvailable();
+	if (available <= 0) {
+		return;
+	}
+	const int oldSize = m_buffer.size();
+	m_buffer.resize(oldSize + int(available));
+	const qint64 read = device->read(m_buffer.data() + oldSize, available);
+	m_buffer.resize(oldSize + int(qMax<qint64>(read, 0)));
+}
+
+bool TcpUtils::FrameReader::next(QByteArray *frame)
+{
+	const int buffered = m_buffer.size() - m_pos;
+	if (buffered < int(sizeof(quint32))) {
+		return false;
+	}
+	const quint32 header = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(m_buffer.constData() + m_pos));
+	const quint32 size = header & ~CompressedFlag;
+	if (size > quint32(m_maxFrameSize)) {
+		throw Exception(QStringLiteral("Frame of %1 bytes exceeds the maximum of %2 bytes").arg(size).arg(m_maxFrameSize));
+	}
+	if (quint32(buffered) - sizeof(quint32) < size) {
+		return false;
+	}
+	*frame = QByteArray::fromRawData(m_buffer.constData() + m_pos + sizeof(quint32), int(size));
+	m_pos += int(sizeof(quint32) + size);
+
+	if (header & CompressedFlag) {
+		// qCompress puts the uncompressed size in front, check it before allocating anything
+		if (frame->size() < int(sizeof(quint32))) {
+			throw Exception(QStringLiteral("Invalid compressed frame"));
+		}
+		const quint32 uncompressedSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(frame->constData()));
+		if (uncompressedSize > quint32(m_maxFrameSize)) {
+			throw Exception(QStringLiteral("Frame of %1 bytes exceeds the maximum of %2 bytes").arg(uncompressedSize).arg(m_maxFrameSize));
+		}
+		m_decompressed = qUncompress(*frame);
+		if (m_decompressed.size() != int(uncompressedSize)) {
+			throw Exception(QStringLiteral("Invalid compressed frame"));
+		}
+		*frame = m_decompressed;
+	}
+	return true;
+}
+
+void TcpUtils::FrameReader::append(const QByteArray &data)
+{
+	compact();
+	m_buffer.append(data);
+}
+
+QByteArray TcpUtils::FrameReader::takeBuffered()
+{
+	const QByteArray data = m_buffer.mid(m_pos);
+	reset();
+	return data;
+}
+
+void TcpUtils::FrameReader::reset()
+{
+	m_buffer.resize(0);
+	m_pos = 0;
+}
+
+void TcpUtils::FrameReader::compact()
+{
+	// drop what has already been consumed, keeping the allocation
+	if (m_pos == m_buffer.size()) {
+		m_buffer.resize(0);
+	} else if (m_pos > 0) {
+		m_buffer.remove(0, m_pos);
+	}
+	m_pos = 0;
+}
+
+TcpUtils::FrameWriter::FrameWriter(QIODevice *device, QObject *parent)
+	: QObject(parent), m_device(device), m_timer(this)
+{
+	m_timer.setSingleShot(true);
+	m_timer.setInterval(0);
+	connect(&m_timer, &QTimer::timeout, this, &FrameWriter::flush);
+}
+
+void TcpUtils::FrameWriter::setLatencyBudget(const int msecs)
+{
+	m_timer.setInterval(msecs);
+	m_timer.setTimerType(msecs > 0 ? Qt::PreciseTimer : Qt::CoarseTimer);
+}
+
+void TcpUtils::FrameWriter::write(const QByteArray &data)
+{
+	if (m_compressionThreshold > 0 && data.size() >= m_compressionThreshold) {
+		const QByteArray compressed = qCompress(data);
+		// some data does not compress well, in which case it is not worth making the other side decompress it
+		if (compressed.size() < data.size()) {
+			appendFrame(&m_buffer, compressed, true);
+		} else {
+			appendFrame(&m_buffer, data);
+		}
+	} else {
+		appendFrame(&m_buffer, data);
+	}
+	if (m_buffer.size() >= m_flushThreshold) {
+		flush();
+	} else if (!m_timer.isActive()) {
+		m_timer.start();
+	}
+}
+
+void TcpUtils::FrameWriter::flush()
+{
+	m_timer.stop();
+	if (m_buffer.isEmpty()) {
+		return;
+	}
+	if (m_device->isOpen() && m_device->isWritable()) {
+		m_device->write(m_buffer);
+	}
+	// keeps the allocation for the next batch
+	m_buffer.resize(0);
+}
+void TcpUtils::FrameWriter::clear()
+{
+	m_timer.stop();
+	m_buffer.resize(0);
+}
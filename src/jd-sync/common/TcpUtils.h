@@ -1,10 +1,110 @@
 #pragma once
 
+#include <QByteArray>
+#include <QObject>
+#include <QTimer>
+
 class QTcpSocket;
-class QByteArray;
+class QIODevice;
 
 namespace TcpUtils
 {
 void writePacket(QTcpSocket *socket, const QByteArray &data);
+/// @note blocks until a whole packet has been received, prefer FrameReader
 QByteArray readPacket(QTcpSocket *socket);
+
+/// Splits the packets written by writePacket out of a byte stream, without blocking
+///
+/// Data is appended to a buffer that is reused for the lifetime of the reader, and the frames
+/// returned by next() point into that buffer instead of being copied. Frames compressed by a
+/// FrameWriter are decompressed transparently.
+class FrameReader
+{
+public:
+	enum
+	{
+		DefaultMaxFrameSize = 64 * 1024 * 1024
+	};
+
+	explicit FrameReader(const int maxFrameSize = DefaultMaxFrameSize);
+
+	int maxFrameSize() const { return m_maxFrameSize; }
+	void setMaxFrameSize(const int size) { m_maxFrameSize = size; }
+
+	/// appends everything that is available on the device
+	/// @note invalidates frames previously returned by next()
+	void readFrom(QIODevice *device);
+	/// extracts the next complete frame, returns false if there is none yet
+	/// @throws Exception if the frame (compressed or not) is larger than the maximum frame size, or
+	///                   if it can not be decompressed
+	bool next(QByteArray *frame);
+	/// appends data that has been read elsewhere
+	/// @note invalidates frames previously returned by next()
+	void append(const QByteArray &data);
+	/// returns and discards everything that has not been consumed by next() yet
+	QByteArray takeBuffered();
+	/// discards all buffered data, for example after a reconnect
+	void reset();
+
+private:
+	QByteArray m_buffer;
+	/// start of the first unconsumed byte in m_buffer
+	int m_pos = 0;
+	int m_maxFrameSize;
+	QByteArray m_decompressed;
+
+	void compact();
+};
+
+/// Collects outgoing frames in a buffer and writes them to the device in one go
+///
+/// By default the buffer is flushed once per event loop iteration, so a burst of messages handled
+/// in the same iteration results in a single write. A latency budget can be set to allow waiting a
+/// bit longer, and once the buffer reaches the flush threshold it is flushed right away.
+///
+/// Frames of at least the compression threshold are compressed individually (zlib, as qCompress),
+/// which is marked by the highest bit of the size. Only enable this if the other side has agreed to
+/// it, older readers do not know about the flag.
+class FrameWriter : public QObject
+{
+	Q_OBJECT
+public:
+	enum
+	{
+		DefaultFlushThreshold = 64 * 1024
+	};
+
+	explicit FrameWriter(QIODevice *device, QObject *parent = nullptr);
+
+	/// size of the buffer at which it is flushed immediately
+	void setFlushThreshold(const int bytes) { m_flushThreshold = bytes; }
+	/// how long (in milliseconds) frames may be kept back, 0 means until the next event loop iteration
+	void setLatencyBudget(const int msecs);
+	/// size from which on frames are compressed, 0 disables compression (the default)
+	void setCompressionThreshold(const int bytes) { m_compressionThreshold = bytes; }
+	int compressionThreshold() const { return m_compressionThreshold; }
+
+	/// queues a frame, in the same format as writePacket
+	void write(const QByteArray &data);
+	int bufferedBytes() const { return m_buffer.size(); }
+
+public slots:
+	void flush();
+	/// discards buffered frames, for example when the connection was lost
+	void clear();
+
+private:
+	QIODevice *m_device;
+	QByteArray m_buffer;
+	QTimer m_timer;
+	int m_flushThreshold = DefaultFlushThreshold;
+	int m_compressionThreshold = 0;
+};
+
+/// compression threshold to use once compression has been negotiated, small control messages gain
+/// nothing from it
+enum
+{
+	DefaultCompressionThreshold = 512
+};
 }
@@ -4,18 +4,30 @@
 
 #include "jd-util/Json.h"
 #include "common/Message.h"
+#include "common/Atom.h"
 
 inline static QJsonValue toJson(const QVariant &v)
 {
 	return QJsonValue::fromVariant(v);
 }
+/// a newer change of the same property of the same row makes older ones obsolete
+inline static QString changeKey(const QVariant &index, const QString &property)
+{
+	return index.toString() + QLatin1Char('\x1f') + property;
+}
 inline static uint qHash(const QMetaMethod &method)
 {
 	return qHash(method.methodIndex());
 }
 
 BaseSyncableList::BaseSyncableList(MessageHub *hub, const QString &channel, const QString &cmdPrefix, const QString &indexProperty, const Flags &flags, QObject *parent)
-	: QObject(parent), AbstractActor(hub), m_channel(channel), m_cmdPrefix(cmdPrefix), m_indexProperty(indexProperty), m_flags(flags)
+	: QObject(parent), AbstractActor(hub), m_channel(channel), m_cmdPrefix(cmdPrefix), m_indexProperty(indexProperty), m_flags(flags),
+	  m_channelAtom(Atom::intern(channel)),
+	  m_addCommand(Atom::intern(command("add"))),
+	  m_removeCommand(Atom::intern(command("remove"))),
+	  m_setCommand(Atom::intern(command("set"))),
+	  m_getCommand(Atom::intern(command("get"))),
+	  m_listCommand(Atom::intern(command("list")))
 {
 	subscribeTo(channel);
 }
@@ -57,20 +69,21 @@ void BaseSyncableList::receive(const Message &msg)
 {
 	using namespace Json;
 
-	if (msg.channel() == m_channel) {
-		if (msg.command() == command("add") && m_flags.testFlag(AllowExternalAdd)) {
+	if (msg.channelAtom() == m_channelAtom) {
+		const int cmd = msg.commandAtom();
+		if (cmd == m_addCommand && m_flags.testFlag(AllowExternalAdd)) {
 			QVariantMap data = ensureObject(msg.data()).toVariantMap();
 			add(data, msg);
-		} else if (msg.command() == command("remove") && m_flags.testFlag(AllowExternalRemove)) {
+		} else if (cmd == m_removeCommand && m_flags.testFlag(AllowExternalRemove)) {
 			remove(ensureVariant(msg.data(), m_indexProperty), msg);
-		} else if (msg.command() == command("set") && m_flags.testFlag(AllowExternalSet)) {
+		} else if (cmd == m_setCommand && m_flags.testFlag(AllowExternalSet)) {
 			for (const QString &key : ensureObject(msg.data()).keys()) {
 				set(ensureVariant(msg.data(), m_indexProperty), key, ensureObject(msg.data()).value(key), msg);
 			}
-		} else if (msg.command() == command("get")) {
+		} else if (cmd == m_getCommand) {
 			const QVariant index = ensureVariant(msg.data(), m_indexProperty);
 			send(msg.createReply(command("item"), QJsonObject::fromVariantMap(getAll(index))));
-		} else if (msg.command() == command("list")) {
+		} else if (cmd == m_listCommand) {
 			QJsonArray array;
 			for (int i = 0; i < size(); ++i) {
 				if (m_flags.testFlag(ListOnlyIndex)) {
@@ -110,7 +123,7 @@ void SyncableList::set(const int index, const QString &property, const QVariant
 			 QJsonObject({
 				 {m_indexProperty, toJson(m_rows.at(index).value(m_indexProperty))},
 				 {property, toJson(value)}
-			 })));
+			 })).setConflationKey(changeKey(m_rows.at(index).value(m_indexProperty), property)));
 	emit changed(index, property);
 }
 QVariant SyncableList::get(const int index, const QString &property) const
@@ -366,7 +379,7 @@ void SyncableQObjectList::propertyChanged()
 		send(Message(m_channel, command("changed"), QJsonObject({
 																	{m_indexProperty, toJson(indexValue(obj))},
 																	{property, toJson(get(m_objects.indexOf(obj), property))}
-																})));
+																})).setConflationKey(changeKey(indexValue(obj), property)));
 		emit changed(m_objects.indexOf(obj), property);
 	}
 }
@@ -377,7 +390,7 @@ void SyncableQObjectList::wrappedPropertyChanged()
 		send(Message(m_channel, command("changed"), QJsonObject({
 																	{m_indexProperty, toJson(indexValue(obj))},
 																	{property, toJson(get(m_objects.indexOf(obj), property))}
-																})));
+																})).setConflationKey(changeKey(indexValue(obj), property)));
 		emit changed(m_objects.indexOf(sender()), property);
 	}
 }
@@ -424,7 +437,7 @@ void SyncableQObjectList::receive(const Message &msg)
 	using namespace Json;
 	BaseSyncableList::receive(msg);
 
-	if (msg.channel().startsWith(m_channel + ':') && m_commandMapping.contains(msg.command())) {
+	if (msg.channelAtom() != m_channelAtom && msg.channel().startsWith(m_channel + ':') && m_commandMapping.contains(msg.command())) {
 		const QString id = QString(msg.channel()).remove(m_channel + ':');
 		QObject *obj = m_mapping.value(id);
 		const QMetaObject *mo = obj->metaObject();
@@ -60,6 +60,14 @@ protected:
 	QString m_indexProperty;
 	Flags m_flags;
 
+	// atoms of m_channel and the incoming commands, used for dispatching in receive
+	int m_channelAtom;
+	int m_addCommand;
+	int m_removeCommand;
+	int m_setCommand;
+	int m_getCommand;
+	int m_listCommand;
+
 	virtual void receive(const Message &msg) override;
 
 	QString command(const QString &command) const;
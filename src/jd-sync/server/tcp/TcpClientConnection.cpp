@@ -1,25 +1,41 @@
 #include "TcpClientConnection.h"
 
 #include <QTcpSocket>
+#include <QJsonArray>
 
 #include <jd-util/Json.h>
 
 #include "common/TcpUtils.h"
 #include "common/Message.h"
+#include "common/Atom.h"
 #include "TcpServer.h"
+#include "TcpSessionStore.h"
 
-TcpClientConnection::TcpClientConnection(MessageHub *hub, qintptr handle, const QString &auth)
-	: AbstractExternalActor(hub), m_handle(handle), m_auth(auth)
+TcpClientConnection::TcpClientConnection(MessageHub *hub, qintptr handle, const Settings &settings, ActorScheduler *scheduler)
+	: AbstractExternalActor(hub, nullptr, scheduler), m_handle(handle), m_auth(settings.auth), m_requiredAuth(settings.auth),
+	  m_reader(settings.maxFrameSize), m_latencyBudget(settings.latencyBudget), m_flushThreshold(settings.flushThreshold),
+	  m_outQueue(settings.limits, settings.metrics.data()), m_metrics(settings.metrics), m_sessions(settings.sessions), m_expiryTimer(this)
 {
+	// only channels the client is interested in are forwarded to it
+	setFollowRemoteInterest(true);
+
+	m_expiryTimer.setSingleShot(true);
+	connect(&m_expiryTimer, &QTimer::timeout, this, &TcpClientConnection::expire);
+}
+TcpClientConnection::~TcpClientConnection()
+{
+	setSlowConsumer(false);
+	if (!m_sessionToken.isNull()) {
+		m_sessions->remove(m_sessionToken, this);
+	}
 }
 
 void TcpClientConnection::run()
 {
 	Q_ASSERT_X(!m_socket, "TcpClientConnection::run", "attempt to re-run");
-	m_socket = new QTcpSocket(this);
-	connect(m_socket, &QTcpSocket::readyRead, this, &TcpClientConnection::readyRead);
-	connect(m_socket, &QTcpSocket::disconnected, this, &TcpClientConnection::disconnected);
-	m_socket->setSocketDescriptor(m_handle);
+	QTcpSocket *socket = new QTcpSocket;
+	socket->setSocketDescriptor(m_handle);
+	attachSocket(socket);
 	qCInfo(Tcp) << "New TCP connection from" << TcpServer::formatAddress(m_socket->peerAddress(), m_socket->peerPort());
 
 	AbstractThreadedActor::run();
@@ -28,49 +44,76 @@ void TcpClientConnection::run()
 static bool isAuthMessage(const Message &msg)
 {
 	using namespace Json;
-	return msg.channel() == "client" && msg.command().startsWith("auth.");
+	return msg.channelAtom() == Atom::Client && msg.command().startsWith("auth.");
 }
 void TcpClientConnection::sendToExternal(const Message &msg)
 {
-	if (m_auth.isNull() || isAuthMessage(msg) || msg.command() == "error") {
-		TcpUtils::writePacket(m_socket, Json::toBinary(msg.toJson()));
+	if (!m_auth.isNull() && (isAuthMessage(msg) || msg.isError())) {
+		write(msg);
 		qCDebug(Tcp) << "sending" << msg.toJson();
 	} else {
-		m_outQueue.enqueue(msg);
+		enqueue(msg);
 	}
 }
 
 void TcpClientConnection::readyRead()
 {
-	while (m_socket->bytesAvailable() > 0)
+	if (m_readBlocked || !m_socket) {
+		return;
+	}
+	m_reader.readFrom(m_socket);
+	QByteArray frame;
+	forever
 	{
+		try {
+			if (!m_reader.next(&frame)) {
+				break;
+			}
+		} catch (Exception &e) {
+			qCWarning(Tcp) << e.cause() << ", closing connection";
+			m_socket->abort();
+			return;
+		}
+
 		Message msg;
 		try {
-			const QJsonDocument doc = Json::ensureDocument(TcpUtils::readPacket(m_socket));
-			msg = Message::fromJson(Json::ensureObject(doc));
+			msg = MessageCodec::decode(frame, &m_decodeTable);
 			qCDebug(Tcp) << "received" << msg.toJson();
 
-			if (msg.channel() == "client.ping" && msg.command() == "request") {
+			if (msg.channelAtom() == Atom::ClientPing && msg.commandAtom() == Atom::Request) {
 				sendToExternal(msg.createTargetedReply("reply", msg.data()));
-			} else if (m_auth.isNull()) {
-				receivedFromExternal(msg);
-			} else if (msg.channel() == "client.auth" && msg.command() == "attempt") {
-				if (Json::ensureString(msg.dataObject(), "token") == m_auth) {
+			} else if (msg.channelAtom() == Atom::ClientAuth && msg.commandAtom() == Atom::Negotiate) {
+				if (!negotiate(msg)) {
+					return;
+				}
+			} else if (msg.channelAtom() == Atom::ClientAuth && msg.commandAtom() == Atom::Attempt) {
+				// a resumed session might already be authenticated
+				if (m_auth.isNull()) {
+					sendToExternal(msg.createReply("response", QJsonObject({{"success", true}})));
+				} else if (Json::ensureString(msg.dataObject(), "token") == m_auth) {
 					m_auth = QString();
 					sendToExternal(msg.createReply("response", QJsonObject({{"success", true}})));
-					sendQueue(&m_outQueue);
-					for (const Message &message : m_inQueue) {
-						receivedFromExternal(message);
+					replay();
+					pump();
+					while (!m_inQueue.isEmpty()) {
+						receivedFromExternal(m_inQueue.dequeue());
 					}
 				} else {
 					sendToExternal(msg.createReply("response", QJsonObject({{"success", false}})));
 				}
+			} else if (m_auth.isNull()) {
+				receivedFromExternal(msg);
 			} else {
 				sendToExternal(msg.createReply("challenge", QJsonValue()));
 				m_inQueue.enqueue(msg);
 			}
 		} catch (Exception &e) {
-			if (msg.isNull()) {
+			if (msg.isNull() && m_useStringTable) {
+				// the frame might have changed our table, it can not be trusted to match the client's anymore
+				qCWarning(Tcp) << e.cause() << ", closing connection";
+				m_socket->abort();
+				return;
+			} else if (msg.isNull()) {
 				qCWarning(Tcp) << e.cause();
 			} else {
 				sendToExternal(msg.createErrorReply(e.cause()));
@@ -82,13 +125,279 @@ void TcpClientConnection::readyRead()
 void TcpClientConnection::disconnected()
 {
 	qCInfo(Tcp) << TcpServer::formatAddress(m_socket->peerAddress(), m_socket->peerPort()) << "disconnected";
+	if (m_sessionToken.isNull()) {
+		m_socket = nullptr;
+		deleteLater();
+		return;
+	}
+
+	// keep going without a socket, buffering for the client in case it comes back
+	m_socket->deleteLater();
 	m_socket = nullptr;
-	deleteLater();
+	m_writer->deleteLater();
+	m_writer = nullptr;
+	m_reader.reset();
+	m_expiryTimer.start(m_sessions->resumeWindow());
+	pump();
+}
+
+void TcpClientConnection::expire()
+{
+	// if the session has been taken in the meantime it is about to be resumed
+	if (m_sessions->remove(m_sessionToken, this)) {
+		qCInfo(Tcp) << "Session" << m_sessionToken << "expired";
+		m_sessionToken = QUuid();
+		deleteLater();
+	}
+}
+
+void TcpClientConnection::enqueue(const Message &msg)
+{
+	// the remote side waits for replies to its requests by id, so they are never replaced
+	// with a string table the message is encoded for this connection only once it is written
+	const int bytes = m_useStringTable ? MessageCodec::estimateSize(msg, m_format) : MessageCodec::encode(msg, m_format).size();
+	const int dropped = m_outQueue.enqueue(msg, bytes, !isReplyToRemote(msg));
+	pump();
+	if (!m_outQueue.isFull() && dropped == 0) {
+		return;
+	}
+
+	if (!m_slowConsumer) {
+		qCWarning(Tcp) << "Outbound queue full for slow client"
+					   << (m_socket ? TcpServer::formatAddress(m_socket->peerAddress(), m_socket->peerPort()) : QStringLiteral("(disconnected)"));
+	}
+	setSlowConsumer(true);
+	switch (m_outQueue.limits().policy) {
+	case OutboundQueue::DropOldest:
+		// already done by the queue
+		break;
+	case OutboundQueue::Block:
+		if (dropped == 0) {
+			if (!m_readBlocked && m_socket) {
+				m_readBlocked = true;
+				m_socket->setReadBufferSize(BlockedReadBufferSize);
+			}
+			break;
+		}
+		// the hard limit has been reached, the client must not go on without noticing what it missed
+		Q_FALLTHROUGH();
+	case OutboundQueue::Disconnect:
+		if (m_socket) {
+			if (m_metrics) {
+				m_metrics->disconnectedConsumers.fetchAndAddRelaxed(1);
+			}
+			// the client would not notice what it missed if it resumed the session
+			if (!m_sessionToken.isNull() && !m_sessions->remove(m_sessionToken, this)) {
+				// a new connection of the client is handing its socket to us, we may not go away before
+				// that, but the client has to start over
+				m_lostMessages = true;
+			} else {
+				m_sessionToken = QUuid();
+			}
+			m_outQueue.clear();
+			m_socket->abort();
+		}
+		break;
+	}
+}
+
+void TcpClientConnection::pump()
+{
+	// everything is held back until the client has authenticated
+	if (!m_auth.isNull()) {
+		return;
+	}
+	while (!m_outQueue.isEmpty()) {
+		if (m_socket && m_socket->bytesToWrite() + m_writer->bufferedBytes() >= SocketHighWaterMark) {
+			break;
+		}
+		write(m_outQueue.dequeue());
+	}
+
+	if (m_slowConsumer && m_outQueue.isBelowLowWater()) {
+		setSlowConsumer(false);
+		if (m_readBlocked && m_socket) {
+			m_readBlocked = false;
+			m_socket->setReadBufferSize(0);
+			QTimer::singleShot(0, this, &TcpClientConnection::readyRead);
+		}
+	}
 }
 
-void TcpClientConnection::sendQueue(QQueue<Message> *queue)
+void TcpClientConnection::setSlowConsumer(const bool slow)
 {
-	while (m_socket->isOpen() && m_socket->isWritable() && !queue->isEmpty()) {
-		TcpUtils::writePacket(m_socket, Json::toBinary(queue->dequeue().toJson()));
+	if (slow == m_slowConsumer) {
+		return;
+	}
+	m_slowConsumer = slow;
+	if (m_metrics) {
+		m_metrics->slowConsumers.fetchAndAddRelaxed(slow ? 1 : -1);
+	}
+}
+
+void TcpClientConnection::attachSocket(QTcpSocket *socket)
+{
+	m_socket = socket;
+	m_socket->setParent(this);
+	connect(m_socket, &QTcpSocket::readyRead, this, &TcpClientConnection::readyRead);
+	connect(m_socket, &QTcpSocket::disconnected, this, &TcpClientConnection::disconnected);
+	connect(m_socket, &QTcpSocket::bytesWritten, this, &TcpClientConnection::pump);
+	m_writer = new TcpUtils::FrameWriter(m_socket, this);
+	m_writer->setLatencyBudget(m_latencyBudget);
+	m_writer->setFlushThreshold(m_flushThreshold);
+	m_readBlocked = false;
+	// the tables are per socket, the client starts over with empty ones
+	m_encodeTable.clear();
+	m_decodeTable.clear();
+	m_useStringTable = false;
+}
+
+void TcpClientConnection::write(const Message &msg)
+{
+	// the client counts the same messages, which tells us where to continue when it resumes
+	if (!m_sessionToken.isNull() && !isControlMessage(msg)) {
+		++m_sentCount;
+		m_replay.enqueue(msg);
+		if (m_replay.size() > m_sessions->replayCapacity()) {
+			m_replay.dequeue();
+		}
+	}
+	if (m_socket) {
+		// with a string table the encoding depends on what has been written before, so it happens here
+		m_writer->write(MessageCodec::encode(msg, m_format, m_useStringTable ? &m_encodeTable : nullptr));
+	}
+}
+
+void TcpClientConnection::replay()
+{
+	// whatever has been dropped from the buffer in the meantime is gone
+	const quint64 firstBuffered = m_sentCount - quint64(m_replay.size());
+	for (quint64 i = qMax(m_replayFrom, firstBuffered); i < m_replayTo; ++i) {
+		m_writer->write(MessageCodec::encode(m_replay.at(int(i - firstBuffered)), m_format, m_useStringTable ? &m_encodeTable : nullptr));
+	}
+	m_replayFrom = m_replayTo = 0;
+}
+
+void TcpClientConnection::enableFeatures(const MessageCodec::Format format, const QJsonArray &features)
+{
+	m_format = format;
+	if (features.contains(compressionFeature())) {
+		m_writer->setCompressionThreshold(TcpUtils::DefaultCompressionThreshold);
+	}
+	m_useStringTable = features.contains(stringTableFeature());
+}
+
+bool TcpClientConnection::negotiate(const Message &msg)
+{
+	const QJsonObject data = msg.dataObject();
+	const MessageCodec::Format format = MessageCodec::negotiate(Json::ensureIsArrayOf<QString>(data, "formats").toList());
+	const QVector<QString> offeredFeatures = Json::ensureIsArrayOf<QString>(data, "features", QVector<QString>());
+	QJsonArray features;
+	if (offeredFeatures.contains(interestFeature())) {
+		features.append(interestFeature());
+	}
+	if (offeredFeatures.contains(compressionFeature())) {
+		features.append(compressionFeature());
+	}
+	// names are only ever literal in JSON
+	if (offeredFeatures.contains(stringTableFeature()) && format == MessageCodec::BinaryFormat) {
+		features.append(stringTableFeature());
+	}
+	if (m_sessions && offeredFeatures.contains(sessionFeature())) {
+		features.append(sessionFeature());
+
+		if (data.contains("session")) {
+			TcpClientConnection *previous = m_sessions->take(Json::ensureUuid(data, "session"));
+			if (previous == this) {
+				m_sessions->insert(m_sessionToken, this);
+			} else if (previous) {
+				// continue in the previous connection, which still has everything the client expects. Now
+				// that its session has been taken it does not delete itself anymore (see expire() and
+				// enqueue()), so it is still there to receive the socket
+				disconnect(m_socket, nullptr, this, nullptr);
+				m_writer->flush();
+				delete m_writer;
+				m_writer = nullptr;
+				QTcpSocket *socket = m_socket;
+				m_socket = nullptr;
+				socket->setParent(nullptr);
+				socket->moveToThread(previous->thread());
+
+				const QByteArray buffered = m_reader.takeBuffered();
+				const MessageCodec::Format replyFormat = m_format;
+				const quint64 received = quint64(Json::ensureDouble(data, "received"));
+				QTimer::singleShot(0, previous, [previous, socket, buffered, msg, replyFormat, format, features, received]() {
+					previous->resumeSession(socket, buffered, msg, replyFormat, format, features, received);
+				});
+				deleteLater();
+				return false;
+			}
+		}
+		if (m_sessionToken.isNull()) {
+			m_sessionToken = m_sessions->add(this);
+		}
+	}
+
+	// the reply still uses the old format, everything after it the negotiated one
+	QJsonObject reply({{"format", MessageCodec::formatName(format)}, {"features", features}});
+	if (!m_sessionToken.isNull()) {
+		reply.insert("session", m_sessionToken.toString());
+		reply.insert("resumed", false);
+	}
+	m_writer->write(MessageCodec::encode(msg.createTargetedReply("negotiated", reply), m_format));
+	enableFeatures(format, features);
+	if (features.contains(interestFeature())) {
+		announceInterest();
+	}
+	return true;
+}
+
+void TcpClientConnection::resumeSession(QTcpSocket *socket, const QByteArray &buffered, const Message &negotiation, const MessageCodec::Format replyFormat,
+										const MessageCodec::Format format, const QJsonArray &features, const quint64 received)
+{
+	if (m_socket) {
+		// we have not noticed yet that the old connection is gone
+		disconnect(m_socket, nullptr, this, nullptr);
+		m_socket->abort();
+		m_socket->deleteLater();
+		delete m_writer;
+	}
+	m_expiryTimer.stop();
+	attachSocket(socket);
+	m_reader.reset();
+	m_reader.append(buffered);
+	m_sessions->insert(m_sessionToken, this);
+
+	// if the client missed more than we kept it needs to start over
+	const quint64 firstBuffered = m_sentCount - quint64(m_replay.size());
+	const bool resumed = !m_lostMessages && received >= firstBuffered && received <= m_sentCount;
+	QJsonObject reply({{"format", MessageCodec::formatName(format)}, {"features", features}});
+	reply.insert("session", m_sessionToken.toString());
+	reply.insert("resumed", resumed);
+	m_writer->write(MessageCodec::encode(negotiation.createTargetedReply("negotiated", reply), replyFormat));
+	enableFeatures(format, features);
+
+	if (resumed) {
+		m_replayFrom = received;
+		m_replayTo = m_sentCount;
+	} else {
+		m_sentCount = 0;
+		m_replay.clear();
+		m_lostMessages = false;
+		m_replayFrom = m_replayTo = 0;
+	}
+	// the session token alone is not enough to get at the messages of the session, the client has to
+	// authenticate again on the new socket
+	m_auth = m_requiredAuth;
+	if (m_auth.isNull()) {
+		replay();
+	}
+	qCInfo(Tcp) << "Session" << m_sessionToken << (resumed ? "resumed from" : "restarted for") << TcpServer::formatAddress(m_socket->peerAddress(), m_socket->peerPort());
+
+	if (features.contains(interestFeature())) {
+		announceInterest();
 	}
+	pump();
+	// there might be more behind the negotiation already
+	readyRead();
 }
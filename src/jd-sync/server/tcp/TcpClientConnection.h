@@ -1,17 +1,41 @@
 #pragma once
 
 #include <QQueue>
+#include <QJsonArray>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QUuid>
 
-#include "common/AbstractExternalActor.h"
-#include "common/Message.h"
+#include "jd-sync/common/AbstractExternalActor.h"
+#include "jd-sync/common/Message.h"
+#include "jd-sync/common/MessageCodec.h"
+#include "jd-sync/common/OutboundQueue.h"
+#include "jd-sync/common/TcpUtils.h"
 
 class QTcpSocket;
+class TcpSessionStore;
 
 class TcpClientConnection : public AbstractExternalActor
 {
 	Q_OBJECT
 public:
-	explicit TcpClientConnection(MessageHub *hub, qintptr handle, const QString &auth);
+	/// configured on the TcpServer, shared by all connections it accepts
+	struct Settings
+	{
+		/// the token clients need to send, null if no authentication is needed
+		QString auth;
+		/// nullptr if sessions are disabled, shared with the connections, which might outlive the server
+		QSharedPointer<TcpSessionStore> sessions;
+		OutboundQueue::Limits limits;
+		/// totals of the outbound queues of all connections
+		QSharedPointer<OutboundQueue::Metrics> metrics;
+		int maxFrameSize = TcpUtils::FrameReader::DefaultMaxFrameSize;
+		int latencyBudget = 0;
+		int flushThreshold = TcpUtils::FrameWriter::DefaultFlushThreshold;
+	};
+
+	explicit TcpClientConnection(MessageHub *hub, qintptr handle, const Settings &settings, ActorScheduler *scheduler = ActorScheduler::global());
+	~TcpClientConnection();
 
 	void run() override;
 
@@ -21,12 +45,71 @@ protected:
 private slots:
 	void readyRead();
 	void disconnected();
+	void pump();
+	void expire();
 
 private:
 	qintptr m_handle;
 	QTcpSocket *m_socket = nullptr;
+	/// the token the client still needs to send, null once it has authenticated
 	QString m_auth;
+	/// the token of the server, a resumed session needs to be authenticated again
+	QString m_requiredAuth;
+	MessageCodec::Format m_format = MessageCodec::JsonFormat;
+	TcpUtils::FrameReader m_reader;
+	TcpUtils::FrameWriter *m_writer = nullptr;
+	/// applied to the writer of every socket, including resumed ones
+	int m_latencyBudget;
+	int m_flushThreshold;
+	/// names we have sent and the client has sent, if the string table has been negotiated
+	MessageCodec::StringTable m_encodeTable;
+	MessageCodec::StringTable m_decodeTable;
+	bool m_useStringTable = false;
+
+	enum
+	{
+		/// bytes that may be waiting in the socket before we keep messages in our own queue
+		SocketHighWaterMark = 256 * 1024,
+		/// while reading is blocked only this much is read from the kernel, so that TCP flow control kicks in
+		BlockedReadBufferSize = 64 * 1024
+	};
+
+	QQueue<Message> m_inQueue;
+	/// messages that have not been handed to the socket yet, also holds them back until authenticated
+	OutboundQueue m_outQueue;
+	QSharedPointer<OutboundQueue::Metrics> m_metrics;
+	/// set while the outbound queue is full, until it has drained to the low water mark
+	bool m_slowConsumer = false;
+	/// set while we are not reading from the client, if the policy is to block
+	bool m_readBlocked = false;
+
+	void enqueue(const Message &msg);
+	void setSlowConsumer(const bool slow);
+
+	/// nullptr if sessions are disabled
+	QSharedPointer<TcpSessionStore> m_sessions;
+	QUuid m_sessionToken;
+	/// number of non-control messages sent (or buffered while disconnected) in this session
+	quint64 m_sentCount = 0;
+	/// the last messages counted in m_sentCount, for replaying to a resumed session
+	QQueue<Message> m_replay;
+	/// set if messages have been discarded without being counted, a resumed session has to start over
+	bool m_lostMessages = false;
+	/// the counts of m_sentCount between which messages are still to be replayed once the client of a
+	/// resumed session has authenticated
+	quint64 m_replayFrom = 0;
+	quint64 m_replayTo = 0;
+	/// started once the socket is gone, the session is dropped if the client does not come back in time
+	QTimer m_expiryTimer;
 
-	QQueue<Message> m_inQueue, m_outQueue;
-	void sendQueue(QQueue<Message> *queue);
+	void attachSocket(QTcpSocket *socket);
+	void write(const Message &msg);
+	/// writes what is left of the replay to the socket
+	void replay();
+	/// enables the features that apply to the connection itself, after the negotiated reply has been written
+	void enableFeatures(const MessageCodec::Format format, const QJsonArray &features);
+	/// @returns false if the connection has been handed over to a previous session
+	bool negotiate(const Message &msg);
+	void resumeSession(QTcpSocket *socket, const QByteArray &buffered, const Message &negotiation, const MessageCodec::Format replyFormat,
+					   const MessageCodec::Format format, const QJsonArray &features, const quint64 received);
 };
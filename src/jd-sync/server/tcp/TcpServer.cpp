@@ -3,40 +3,152 @@
 #include <QTcpSocket>
 #include <QTcpServer>
 #include <QThread>
+#include <QTimer>
 
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+#include "common/ActorScheduler.h"
 #include "TcpClientConnection.h"
+#include "TcpSessionStore.h"
 
 Q_LOGGING_CATEGORY(Tcp, "tablesync.tcp.server")
 
 class TcpServerImpl : public QTcpServer
 {
+	Q_OBJECT
 public:
-	explicit TcpServerImpl(TcpServer *server, QObject *parent = nullptr)
-		: QTcpServer(parent), m_server(server) {}
+	explicit TcpServerImpl(TcpServer *server, ActorScheduler *reactor = nullptr, QObject *parent = nullptr)
+		: QTcpServer(parent), m_server(server), m_reactor(reactor) {}
+
+public slots:
+	void stop() { close(); }
 
 protected:
 	void incomingConnection(qintptr handle)
 	{
-		new TcpClientConnection(m_server->hub(), handle, m_server->m_authentication);
+		m_server->connectionAccepted(handle, m_reactor);
 	}
 
 private:
 	TcpServer *m_server;
+	/// the reactor this listener runs on, connections accepted by it stay there
+	ActorScheduler *m_reactor;
 };
 
+#ifdef Q_OS_LINUX
+static qintptr createReusePortSocket(const QHostAddress &address, const quint16 port)
+{
+	const bool ipv6 = address.protocol() == QAbstractSocket::IPv6Protocol;
+	const int fd = ::socket(ipv6 ? AF_INET6 : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	const int one = 1;
+	::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+	sockaddr_storage storage;
+	std::memset(&storage, 0, sizeof(storage));
+	socklen_t length;
+	if (ipv6) {
+		sockaddr_in6 *addr = reinterpret_cast<sockaddr_in6 *>(&storage);
+		addr->sin6_family = AF_INET6;
+		addr->sin6_port = htons(port);
+		const Q_IPV6ADDR ip = address.toIPv6Address();
+		std::memcpy(&addr->sin6_addr, &ip, sizeof(ip));
+		length = sizeof(sockaddr_in6);
+	} else {
+		sockaddr_in *addr = reinterpret_cast<sockaddr_in *>(&storage);
+		addr->sin_family = AF_INET;
+		addr->sin_port = htons(port);
+		addr->sin_addr.s_addr = htonl(address.toIPv4Address());
+		length = sizeof(sockaddr_in);
+	}
+
+	if (::bind(fd, reinterpret_cast<sockaddr *>(&storage), length) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+static quint16 localPort(const qintptr fd)
+{
+	sockaddr_storage storage;
+	socklen_t length = sizeof(storage);
+	if (::getsockname(int(fd), reinterpret_cast<sockaddr *>(&storage), &length) != 0) {
+		return 0;
+	}
+	if (storage.ss_family == AF_INET6) {
+		return ntohs(reinterpret_cast<sockaddr_in6 *>(&storage)->sin6_port);
+	} else {
+		return ntohs(reinterpret_cast<sockaddr_in *>(&storage)->sin_port);
+	}
+}
+#endif
+
 TcpServer::TcpServer(MessageHub *hub, const QHostAddress &address, const quint16 port)
 	: AbstractActor(hub), m_address(address), m_port(port), m_server(new TcpServerImpl(this))
 {
+	m_connectionSettings.sessions.reset(new TcpSessionStore);
+	m_connectionSettings.metrics.reset(new OutboundQueue::Metrics);
+}
+TcpServer::~TcpServer()
+{
+	// the listeners accept on their reactor threads, once they have stopped there nothing refers to us anymore
+	for (TcpServerImpl *listener : m_listeners) {
+		QMetaObject::invokeMethod(listener, "stop", Qt::BlockingQueuedConnection);
+		listener->deleteLater();
+	}
+	// also cancels connections accepted by the listeners that have not been created yet
+	delete m_server;
 }
 
 void TcpServer::setAuthentication(const QString &data)
 {
-	m_authentication = data;
+	m_connectionSettings.auth = data;
+}
+
+void TcpServer::setSessionResumption(const int resumeWindow, const int replayCapacity)
+{
+	Q_ASSERT_X(!m_server->isListening(), "TcpServer::setSessionResumption", "needs to be called before start()");
+	if (resumeWindow > 0) {
+		m_connectionSettings.sessions.reset(new TcpSessionStore(resumeWindow, replayCapacity));
+	} else {
+		m_connectionSettings.sessions.reset();
+	}
+}
+
+void TcpServer::setReactorThreads(const int count, const bool reusePort)
+{
+	Q_ASSERT_X(!m_server->isListening(), "TcpServer::setReactorThreads", "needs to be called before start()");
+	Q_ASSERT_X(m_reactors.isEmpty(), "TcpServer::setReactorThreads", "may only be called once");
+	for (int i = 0; i < count; ++i) {
+		m_reactors.append(new ActorScheduler(1));
+	}
+	m_reusePort = reusePort && count > 0;
+#ifndef Q_OS_LINUX
+	if (m_reusePort) {
+		qCWarning(Tcp) << "SO_REUSEPORT is not supported on this platform, using a single listener";
+		m_reusePort = false;
+	}
+#endif
 }
 
 void TcpServer::start()
 {
-	if (!m_server->listen(m_address, m_port)) {
+	if (m_reusePort) {
+		if (!startReusePortListeners()) {
+			qCWarning(Tcp) << "Unable to start TCP server: could not create listening sockets";
+			std::exit(1);
+		}
+		qCInfo(Tcp) << "TCP server started on" << formatAddress(m_address, m_boundPort) << "with" << m_reactors.size() << "reactors";
+	} else if (!m_server->listen(m_address, m_port)) {
 		qCWarning(Tcp) << "Unable to start TCP server:" << m_server->errorString();
 		std::exit(1);
 	} else {
@@ -46,10 +158,59 @@ void TcpServer::start()
 
 quint16 TcpServer::port() const
 {
-	return m_server->serverPort();
+	return m_reusePort ? m_boundPort : m_server->serverPort();
 }
 
-const char *TcpServer::formatAddress(const QHostAddress &address, const quint16 port)
+QString TcpServer::formatAddress(const QHostAddress &address, const quint16 port)
 {
-	return QString("%1:%2").arg(address.toString()).arg(port).toUtf8().constData();
+	return QString("%1:%2").arg(address.toString()).arg(port);
 }
+
+void TcpServer::connectionAccepted(const qintptr handle, ActorScheduler *reactor)
+{
+	// actors need to be created on the thread of the hub, which is where m_server lives
+	if (QThread::currentThread() == m_server->thread()) {
+		createConnection(handle, reactor);
+	} else {
+		QTimer::singleShot(0, m_server, [this, handle, reactor]() { createConnection(handle, reactor); });
+	}
+}
+void TcpServer::createConnection(const qintptr handle, ActorScheduler *reactor)
+{
+	if (!reactor && !m_reactors.isEmpty()) {
+		reactor = m_reactors.at(m_nextReactor);
+		m_nextReactor = (m_nextReactor + 1) % m_reactors.size();
+	}
+	new TcpClientConnection(hub(), handle, m_connectionSettings, reactor ? reactor : ActorScheduler::global());
+}
+
+bool TcpServer::startReusePortListeners()
+{
+#ifdef Q_OS_LINUX
+	quint16 port = m_port;
+	for (ActorScheduler *reactor : m_reactors) {
+		const qintptr fd = createReusePortSocket(m_address, port);
+		if (fd == -1) {
+			return false;
+		}
+		// with port 0 the first listener picks one, the others need to share it
+		if (port == 0) {
+			port = localPort(fd);
+		}
+		TcpServerImpl *listener = new TcpServerImpl(this, reactor);
+		if (!listener->setSocketDescriptor(fd)) {
+			::close(int(fd));
+			delete listener;
+			return false;
+		}
+		listener->moveToThread(reactor->thread(0));
+		m_listeners.append(listener);
+	}
+	m_boundPort = port;
+	return true;
+#else
+	return false;
+#endif
+}
+
+#include "TcpServer.moc"
@@ -2,20 +2,53 @@
 
 #include <QHostAddress>
 #include <QLoggingCategory>
+#include <QSharedPointer>
+#include <QVector>
 #include "jd-sync/common/AbstractActor.h"
+#include "jd-sync/common/OutboundQueue.h"
+#include "TcpClientConnection.h"
+
+class ActorScheduler;
 
 class TcpServer : public AbstractActor
 {
 public:
 	explicit TcpServer(MessageHub *hub, const QHostAddress &address, const quint16 port);
+	~TcpServer();
 
 	void setAuthentication(const QString &data);
+	/// clients that reconnect within resumeWindow milliseconds get the messages they missed (up to
+	/// replayCapacity per connection) instead of having to reset, a window of 0 disables this. the
+	/// missed messages are only sent once the client has authenticated on the new connection
+	/// @note needs to be called before start()
+	void setSessionResumption(const int resumeWindow, const int replayCapacity = 1024);
+	/// limits for the messages waiting to be sent to each client, and what to do with clients that
+	/// cannot keep up with them
+	/// @note only affects connections accepted afterwards
+	void setOutboundLimits(const OutboundQueue::Limits &limits) { m_connectionSettings.limits = limits; }
+	/// totals of the outbound queues of all connections
+	const OutboundQueue::Metrics &outboundMetrics() const { return *m_connectionSettings.metrics; }
+	/// largest frame accepted from clients, connections sending larger ones are closed
+	/// @note only affects connections accepted afterwards
+	void setMaxFrameSize(const int bytes) { m_connectionSettings.maxFrameSize = bytes; }
+	/// how long (in milliseconds) outgoing frames may be collected before they are written, and the
+	/// amount of buffered data at which they are written right away, see TcpUtils::FrameWriter
+	/// @note only affects connections accepted afterwards
+	void setLatencyBudget(const int msecs) { m_connectionSettings.latencyBudget = msecs; }
+	void setFlushThreshold(const int bytes) { m_connectionSettings.flushThreshold = bytes; }
+	/// serve connections from a fixed set of reactor threads instead of the shared actor pool
+	///
+	/// Each reactor is a single thread with its own event loop, running many connections. With
+	/// reusePort every reactor additionally gets its own listening socket (using SO_REUSEPORT, Linux
+	/// only), so that accepting is spread across the reactors by the kernel.
+	/// @note needs to be called before start()
+	void setReactorThreads(const int count, const bool reusePort = false);
 
 	void start();
 
 	quint16 port() const;
 
-	static const char *formatAddress(const QHostAddress &address, const quint16 port);
+	static QString formatAddress(const QHostAddress &address, const quint16 port);
 
 protected:
 	void receive(const Message &/*message*/) override {}
@@ -23,10 +56,24 @@ protected:
 private:
 	QHostAddress m_address;
 	quint16 m_port;
-	QString m_authentication;
+	/// passed to every accepted connection
+	TcpClientConnection::Settings m_connectionSettings;
 
 	friend class TcpServerImpl;
 	class TcpServerImpl *m_server;
+
+	/// single threaded schedulers, intentionally never deleted as connections might outlive the server
+	QVector<ActorScheduler *> m_reactors;
+	/// one per reactor if reusePort is set, each living on its reactor thread
+	QVector<TcpServerImpl *> m_listeners;
+	int m_nextReactor = 0;
+	bool m_reusePort = false;
+	quint16 m_boundPort = 0;
+
+	/// may be called from any listener thread
+	void connectionAccepted(const qintptr handle, ActorScheduler *reactor);
+	void createConnection(const qintptr handle, ActorScheduler *reactor);
+	bool startReusePortListeners();
 };
 
 Q_DECLARE_LOGGING_CATEGORY(Tcp)
@@ -0,0 +1,35 @@
+#include "TcpSessionStore.h"
+
+TcpSessionStore::TcpSessionStore(const int resumeWindow, const int replayCapacity)
+	: m_resumeWindow(resumeWindow), m_replayCapacity(replayCapacity) {}
+
+QUuid TcpSessionStore::add(TcpClientConnection *connection)
+{
+	// the token is all that is needed to take over a session, so it needs to be unpredictable
+	const QUuid token = QUuid::createUuid();
+	insert(token, connection);
+	return token;
+}
+
+void TcpSessionStore::insert(const QUuid &token, TcpClientConnection *connection)
+{
+	QMutexLocker locker(&m_mutex);
+	m_sessions.insert(token, connection);
+}
+
+TcpClientConnection *TcpSessionStore::take(const QUuid &token)
+{
+	QMutexLocker locker(&m_mutex);
+	return m_sessions.take(token);
+}
+
+bool TcpSessionStore::remove(const QUuid &token, TcpClientConnection *connection)
+{
+	QMutexLocker locker(&m_mutex);
+	const auto it = m_sessions.find(token);
+	if (it == m_sessions.end() || it.value() != connection) {
+		return false;
+	}
+	m_sessions.erase(it);
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QUuid>
+
+class TcpClientConnection;
+
+/// Keeps track of the sessions of a TcpServer, so that a client that reconnects can be handed back to its previous connection
+///
+/// A connection stays alive for the resume window after its socket has been closed, buffering what
+/// it would have sent. Connections live on different threads, so all access is synchronized.
+class TcpSessionStore
+{
+public:
+	explicit TcpSessionStore(const int resumeWindow = 30 * 1000, const int replayCapacity = 1024);
+
+	/// time in milliseconds a connection waits for its client to come back
+	int resumeWindow() const { return m_resumeWindow; }
+	/// number of messages kept for replaying to a resumed session
+	int replayCapacity() const { return m_replayCapacity; }
+
+	/// starts a new session for the connection, returns the token identifying it
+	QUuid add(TcpClientConnection *connection);
+	void insert(const QUuid &token, TcpClientConnection *connection);
+	/// removes the session and returns its connection, or nullptr if there is no such session
+	TcpClientConnection *take(const QUuid &token);
+	/// removes the session only if it still belongs to the connection
+	/// @returns false if it has been taken (or removed) already
+	bool remove(const QUuid &token, TcpClientConnection *connection);
+
+private:
+	const int m_resumeWindow;
+	const int m_replayCapacity;
+
+	QMutex m_mutex;
+	QHash<QUuid, TcpClientConnection *> m_sessions;
+};
@@ -11,19 +11,28 @@ public:
 	using AbstractActor::subscribeTo;
 	using AbstractActor::unsubscribeFrom;
 	using AbstractActor::send;
+	using AbstractActor::sendBatch;
 	using AbstractActor::channels;
 	using AbstractActor::request;
 
 	QVector<Message> messages() const { return m_messages; }
 	int resets() const { return m_resetCounter; }
+	/// sizes of the batches received through receiveBatch
+	QVector<int> batches() const { return m_batches; }
 
 	static void setMessageTo(Message &msg, AbstractActor *to) { msg.m_to = to; }
 	static void setMessageFrom(Message &msg, AbstractActor *from) { msg.m_from = from; }
 
 private:
 	void receive(const Message &msg) override { m_messages.append(msg); }
+	void receiveBatch(const QVector<Message> &messages) override
+	{
+		m_batches.append(messages.size());
+		AbstractActor::receiveBatch(messages);
+	}
 	void reset() override { m_resetCounter++; }
 	QVector<Message> m_messages;
+	QVector<int> m_batches;
 	int m_resetCounter = 0;
 };
 
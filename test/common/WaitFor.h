@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <functional>
+
+/// runs the event loop until the condition is met, or a few seconds have passed
+static inline bool waitFor(const std::function<bool()> &condition, const int timeout = 5000)
+{
+	QElapsedTimer timer;
+	timer.start();
+	while (!condition() && timer.elapsed() < timeout) {
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+	}
+	return condition();
+}
@@ -5,6 +5,9 @@
 
 #include "Message.h"
 #include "MessageHub.h"
+#include "Atom.h"
+#include "CRUDMessages.h"
+#include "StringDelta.h"
 
 #include "DummyActor.h"
 
@@ -129,3 +132,202 @@ TEST_CASE("message json (de-)serialization", "[Message]") {
 	REQUIRE(m2.toJson() == Message::fromJson(m2.toJson()).toJson());
 	REQUIRE(m3.toJson() == Message::fromJson(m3.toJson()).toJson());
 }
+
+TEST_CASE("message atoms", "[Message][Atom]") {
+	REQUIRE(Atom::intern("client") == Atom::Client);
+	REQUIRE(Atom::intern("index:result") == Atom::IndexResult);
+	REQUIRE(Atom::intern(QString()) == Atom::Null);
+	REQUIRE(Atom::toString(Atom::Wildcard) == "*");
+
+	const int dynamic = Atom::intern("some.channel");
+	REQUIRE(dynamic >= Atom::FirstDynamic);
+	REQUIRE(Atom::intern("some.channel") == dynamic);
+	REQUIRE(Atom::toString(dynamic) == "some.channel");
+
+	Message m1{"some.channel", "create"};
+	REQUIRE(m1.channelAtom() == dynamic);
+	REQUIRE(m1.commandAtom() == Atom::Create);
+	REQUIRE(m1.isCreate());
+
+	m1.setCommand("update:result");
+	REQUIRE(m1.commandAtom() == Atom::UpdateResult);
+	REQUIRE(m1.isUpdateReply());
+	m1.setChannel("client");
+	REQUIRE(m1.channelAtom() == Atom::Client);
+
+	REQUIRE(Message::fromJson(m1.toJson()).commandAtom() == Atom::UpdateResult);
+}
+
+TEST_CASE("received names are not registered", "[Message][Atom]") {
+	const QJsonObject json = Message("remote.channel", "remote.command").toJson();
+	REQUIRE(Atom::find("remote.channel") != Atom::Unknown);
+
+	QJsonObject unknown = json;
+	unknown["ch"] = "never.subscribed";
+	unknown["cmd"] = "never.used";
+	const Message received = Message::fromJson(unknown);
+	REQUIRE(received.channelAtom() == Atom::Unknown);
+	REQUIRE(received.commandAtom() == Atom::Unknown);
+	REQUIRE(Atom::find("never.subscribed") == Atom::Unknown);
+	REQUIRE(received.createReply("result", QJsonValue()).channelAtom() == Atom::Unknown);
+	REQUIRE(Atom::find("never.subscribed") == Atom::Unknown);
+
+	// unknown names are compared by their strings
+	QJsonObject other = unknown;
+	other["ch"] = "never.subscribed.either";
+	REQUIRE(Message::fromJson(unknown) == received);
+	REQUIRE(Message::fromJson(other) != received);
+	REQUIRE(Message("never.subscribed", "never.used") == received);
+}
+
+TEST_CASE("message copy on write", "[Message]") {
+	Message m1{"a", "test", QJsonArray({1, 2})};
+	Message m2 = m1;
+	REQUIRE(m2.id() == m1.id());
+	REQUIRE(m2 == m1);
+
+	m2.setData(QJsonArray({3}));
+	REQUIRE(m1.data() == QJsonArray({1, 2}));
+	REQUIRE(m2.data() == QJsonArray({3}));
+	REQUIRE(m2.id() == m1.id());
+
+	m2.setFlags(Message::Internal);
+	REQUIRE(m2.isInternal());
+	REQUIRE_FALSE(m1.isInternal());
+
+	Message null;
+	REQUIRE(null.isNull());
+	null.setCommand("test");
+	REQUIRE(Message().command().isEmpty());
+}
+
+TEST_CASE("crud message views", "[Message]") {
+	const CreateMessage create{"a", "table", QVector<QJsonObject>() << QJsonObject({{"id", 1}}) << QJsonObject({{"id", 2}})};
+	REQUIRE(create.items().size() == 2);
+
+	const Message msg = Message::fromJson(create.toJson());
+	REQUIRE(msg.toCreate().table() == "table");
+	REQUIRE(msg.toCreate().items().toVector() == create.items().toVector());
+	int count = 0;
+	for (const QJsonObject &item : msg.toCreate().items()) {
+		REQUIRE(item.value("id").toInt() == ++count);
+	}
+	REQUIRE(count == 2);
+
+	// changing the data of a copy does not affect the cached view of the original
+	Message copy = msg;
+	copy.setData(QJsonObject({{"table", "other"}, {"items", QJsonArray()}}));
+	REQUIRE(copy.toCreate().table() == "other");
+	REQUIRE(copy.toCreate().items().isEmpty());
+	REQUIRE(msg.toCreate().table() == "table");
+
+	Message invalid{"a", "create", QJsonObject({{"table", "table"}, {"items", QJsonArray({1})}})};
+	REQUIRE_THROWS(invalid.toCreate());
+}
+
+TEST_CASE("columnar crud items", "[Message]") {
+	const QVector<QJsonObject> items = QVector<QJsonObject>()
+			<< QJsonObject({{"id", 1}, {"name", "a"}})
+			<< QJsonObject({{"id", 2}, {"name", "b"}})
+			<< QJsonObject({{"id", 3}, {"name", "c"}});
+	const IndexMessage request = IndexMessage("a", "table").setColumnarReply();
+
+	const Message reply = Message::fromJson(request.createSuccessReply(items).toJson());
+	REQUIRE(reply.dataObject().contains("columns"));
+	REQUIRE_FALSE(reply.dataObject().contains("items"));
+	const JsonObjectRange range = reply.toIndexReply().items();
+	REQUIRE(range.isColumnar());
+	REQUIRE(range.size() == 3);
+	REQUIRE(range.columns() == QVector<QString>({"id", "name"}));
+	REQUIRE(range.value(1, 1).toString() == "b");
+	REQUIRE(range.toVector() == items);
+
+	// only used if asked for and if all items have the same keys
+	REQUIRE(IndexMessage("a", "table").createSuccessReply(items).dataObject().contains("items"));
+	const QVector<QJsonObject> mixed = QVector<QJsonObject>() << items.first() << QJsonObject({{"id", 4}});
+	REQUIRE_FALSE(Message::fromJson(request.createSuccessReply(mixed).toJson()).toIndexReply().items().isColumnar());
+
+	Message invalid{"a", "index:result", QJsonObject({{"table", "table"}, {"columns", QJsonArray({"id", "name"})}, {"values", QJsonArray({QJsonArray({1})})}})};
+	REQUIRE_THROWS(invalid.toIndexReply());
+}
+
+TEST_CASE("schema ordinals", "[Message]") {
+	const Schema schema(QVector<QString>({"id", "name", "value"}));
+	REQUIRE(schema.fingerprint() == Schema::fingerprint(QVector<QString>({"id", "name", "value"})));
+	REQUIRE(schema.fingerprint() != Schema::fingerprint(QVector<QString>({"id", "value", "name"})));
+	REQUIRE(schema.ordinal("value") == 2);
+	REQUIRE(schema.ordinal("other") == -1);
+
+	const QVector<QJsonObject> items = QVector<QJsonObject>()
+			<< QJsonObject({{"id", 1}, {"name", "a"}})
+			<< QJsonObject({{"id", 2}, {"name", "b"}});
+
+	// the first request announces the columns, later ones only refer to them
+	const IndexMessage announcing = Message::fromJson(IndexMessage("a", "table").setColumnarReply().setSchema(schema, true).toJson()).toIndex();
+	REQUIRE(announcing.replySchema().columns() == schema.columns());
+	const IndexMessage request = Message::fromJson(IndexMessage("a", "table").setColumnarReply().setSchema(schema, false).toJson()).toIndex();
+	REQUIRE(request.replySchema().fingerprint() == schema.fingerprint());
+
+	const Message reply = Message::fromJson(request.createSuccessReply(items).toJson());
+	REQUIRE(reply.dataObject().value("ordinals").toArray() == QJsonArray({0, 1}));
+	REQUIRE_FALSE(reply.dataObject().contains("columns"));
+	const JsonObjectRange range = reply.toIndexReply().items();
+	REQUIRE(range.schema() == schema.fingerprint());
+	REQUIRE(range.ordinals() == QVector<int>({0, 1}));
+	REQUIRE(range.toVector() == items);
+
+	// unknown schemas and columns fall back to names
+	REQUIRE(IndexMessage("a", "table").setColumnarReply().setSchema(Schema(QVector<QString>({"unknown"})), false).createSuccessReply(items).dataObject().contains("columns"));
+	const QVector<QJsonObject> extra = QVector<QJsonObject>()
+			<< QJsonObject({{"id", 1}, {"other", "a"}})
+			<< QJsonObject({{"id", 2}, {"other", "b"}});
+	REQUIRE(request.createSuccessReply(extra).dataObject().contains("columns"));
+
+	Message invalid{"a", "index:result", QJsonObject({{"table", "table"}, {"schema", "0000"}, {"ordinals", QJsonArray({0})}, {"values", QJsonArray({QJsonArray({1})})}})};
+	REQUIRE_THROWS(invalid.toIndexReply());
+}
+
+TEST_CASE("string deltas", "[Message]") {
+	const QString base = QString("lorem ipsum ").repeated(200);
+	const QString edited = QString(base).insert(1000, "dolor sit amet ");
+
+	const QJsonValue delta = StringDelta::create(base, edited);
+	REQUIRE(StringDelta::isDelta(delta));
+	REQUIRE(delta.toObject().value("$delta").toObject().value("insert").toString().size() < 100);
+	REQUIRE(StringDelta::apply(base, delta) == QJsonValue(edited));
+	REQUIRE(StringDelta::isApplied(edited, delta));
+	REQUIRE_THROWS(StringDelta::apply(edited, delta));
+
+	// short or unrelated values are sent in full
+	REQUIRE(StringDelta::create("short", "shorter") == QJsonValue("shorter"));
+	REQUIRE(StringDelta::create(base, QString("x").repeated(2000)) == QJsonValue(QString("x").repeated(2000)));
+
+	const QJsonObject item({{"id", "a"}, {"text", edited}, {"count", 1}});
+	const QJsonObject deltas = StringDelta::createAll(QJsonObject({{"text", base}}), item);
+	REQUIRE(StringDelta::containsDelta(deltas));
+	REQUIRE(StringDelta::resolve(QJsonObject({{"text", base}}), deltas) == item);
+	REQUIRE(StringDelta::resolve(QJsonObject({{"text", edited}}), deltas) == item);
+	REQUIRE_THROWS(StringDelta::resolve(QJsonObject({{"text", "other"}}), deltas));
+}
+
+TEST_CASE("the schema registry is bounded", "[Message]") {
+	const Schema first(QVector<QString>({"bounded", "0"}));
+	Schema::registerSchema(first);
+	REQUIRE_FALSE(Schema::registered(first.fingerprint()).isNull());
+	for (int i = 1; i <= Schema::MaxRegistered; ++i) {
+		Schema::registerSchema(Schema(QVector<QString>({"bounded", QString::number(i)})));
+	}
+	REQUIRE(Schema::registered(first.fingerprint()).isNull());
+	REQUIRE_FALSE(Schema::registered(Schema::fingerprint(QVector<QString>({"bounded", QString::number(Schema::MaxRegistered)}))).isNull());
+
+	// resolved once when the request is decoded, not for every reply
+	const Schema schema(QVector<QString>({"id", "name"}));
+	const IndexMessage request = Message::fromJson(IndexMessage("a", "table").setColumnarReply().setSchema(schema, true).toJson()).toIndex();
+	REQUIRE(request.replySchema().fingerprint() == schema.fingerprint());
+	for (int i = 0; i < Schema::MaxRegistered; ++i) {
+		Schema::registerSchema(Schema(QVector<QString>({"evicting", QString::number(i)})));
+	}
+	REQUIRE(Schema::registered(schema.fingerprint()).isNull());
+	REQUIRE(request.replySchema().fingerprint() == schema.fingerprint());
+	REQUIRE(request.createSuccessReply(QVector<QJsonObject>({QJsonObject({{"id", 1}, {"name", "a"}})})).dataObject().contains("ordinals"));
+}
@@ -0,0 +1,110 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <jd-util/Json.h>
+#include <jd-util/Exception.h>
+
+#include "Message.h"
+#include "MessageCodec.h"
+
+#include "DummyActor.h"
+
+static void requireRoundTrip(const Message &msg, const MessageCodec::Format format)
+{
+	const Message decoded = MessageCodec::decode(MessageCodec::encode(msg, format));
+	REQUIRE(decoded.toJson() == msg.toJson());
+	REQUIRE(decoded.channelAtom() == msg.channelAtom());
+	REQUIRE(decoded.commandAtom() == msg.commandAtom());
+}
+
+TEST_CASE("message binary (de-)serialization", "[MessageCodec]") {
+	const QJsonObject data = QJsonObject({
+											 {"table", "foo"},
+											 {"items", QJsonArray({QJsonObject({{"id", "abc"}, {"count", 42}, {"ratio", 0.25}, {"flag", true}}),
+																   QJsonObject({{"id", "def"}, {"count", -7}, {"nested", QJsonArray({1, "two", QJsonValue()})}})})}
+										 });
+
+	for (const MessageCodec::Format format : {MessageCodec::JsonFormat, MessageCodec::BinaryFormat}) {
+		requireRoundTrip(Message("a", "test1"), format);
+		requireRoundTrip(Message("some.channel", "update:result", data), format);
+		requireRoundTrip(Message("b", "test2", QJsonArray({"asdf", 1e100, -0.5})).createReply("reply", "text"), format);
+		requireRoundTrip(Message("client.ping", "request", 1234567890123.0), format);
+	}
+}
+
+TEST_CASE("binary messages are smaller", "[MessageCodec]") {
+	const Message msg{"client", "create", QJsonObject({{"table", "foo"}, {"items", QJsonArray()}})};
+	REQUIRE(MessageCodec::encode(msg, MessageCodec::BinaryFormat).size() < MessageCodec::encode(msg, MessageCodec::JsonFormat).size());
+}
+
+TEST_CASE("invalid binary messages are rejected", "[MessageCodec]") {
+	const QByteArray valid = MessageCodec::encode(Message("a", "test1", QJsonObject({{"foo", "bar"}})), MessageCodec::BinaryFormat);
+	REQUIRE_NOTHROW(MessageCodec::decode(valid));
+	REQUIRE_THROWS_AS(MessageCodec::decode(valid.left(valid.size() - 1)), Exception);
+	REQUIRE_THROWS_AS(MessageCodec::decode(valid + 'x'), Exception);
+	REQUIRE_THROWS_AS(MessageCodec::decode(valid.left(10)), Exception);
+}
+
+TEST_CASE("format negotiation", "[MessageCodec]") {
+	REQUIRE(MessageCodec::negotiate(MessageCodec::formatNames()) == MessageCodec::BinaryFormat);
+	REQUIRE(MessageCodec::negotiate(QStringList() << "json" << "binary1") == MessageCodec::JsonFormat);
+	REQUIRE(MessageCodec::negotiate(QStringList() << "unknown") == MessageCodec::JsonFormat);
+	REQUIRE(MessageCodec::negotiate(QStringList()) == MessageCodec::JsonFormat);
+}
+
+TEST_CASE("encoded messages are cached", "[MessageCodec]") {
+	Message msg{"a", "test", QJsonObject({{"key", "value"}})};
+	const Message copy = msg;
+
+	const QByteArray first = MessageCodec::encode(msg, MessageCodec::BinaryFormat);
+	// copies share the encoded bytes as well
+	REQUIRE(MessageCodec::encode(copy, MessageCodec::BinaryFormat).constData() == first.constData());
+
+	msg.setData(QJsonObject({{"key", "other"}}));
+	const QByteArray second = MessageCodec::encode(msg, MessageCodec::BinaryFormat);
+	REQUIRE(second != first);
+	REQUIRE(MessageCodec::decode(second).data() == msg.data());
+	REQUIRE(MessageCodec::encode(copy, MessageCodec::BinaryFormat) == first);
+}
+
+TEST_CASE("string tables", "[MessageCodec]") {
+	MessageCodec::StringTable encodeTable;
+	MessageCodec::StringTable decodeTable;
+	const Message msg{"some_channel", "some_command", QJsonObject({{"property", 1}, {"other_property", "value"}})};
+
+	const QByteArray first = MessageCodec::encode(msg, MessageCodec::BinaryFormat, &encodeTable);
+	const QByteArray second = MessageCodec::encode(msg, MessageCodec::BinaryFormat, &encodeTable);
+	REQUIRE(second.size() < first.size());
+	REQUIRE(encodeTable.size() == 4);
+
+	// the decoder needs to see them in the same order
+	REQUIRE(MessageCodec::decode(first, &decodeTable).toJson() == msg.toJson());
+	REQUIRE(MessageCodec::decode(second, &decodeTable).toJson() == msg.toJson());
+	REQUIRE_THROWS_AS(MessageCodec::decode(second), Exception);
+	MessageCodec::StringTable empty;
+	REQUIRE_THROWS_AS(MessageCodec::decode(second, &empty), Exception);
+
+	// JSON does not use it
+	REQUIRE(MessageCodec::encode(msg, MessageCodec::JsonFormat, &encodeTable) == MessageCodec::encode(msg, MessageCodec::JsonFormat));
+
+	// the oldest entries are evicted first, the same way on both sides
+	MessageCodec::StringTable table;
+	for (int i = 0; i < MessageCodec::StringTable::MaxEntries + 1; ++i) {
+		table.insert(QString("name%1").arg(i));
+	}
+	REQUIRE(table.size() == MessageCodec::StringTable::MaxEntries);
+	REQUIRE(table.indexOf("name0") == -1);
+	REQUIRE(table.indexOf(QString("name%1").arg(MessageCodec::StringTable::MaxEntries)) == 0);
+	REQUIRE(table.at(table.size() - 1) == "name1");
+}
+
+TEST_CASE("size estimates", "[MessageCodec]") {
+	const Message msg{"some_channel", "some_command", QJsonObject({{"property", 1}, {"other_property", QString(200, 'x')}})};
+	const int estimate = MessageCodec::estimateSize(msg, MessageCodec::BinaryFormat);
+	const int actual = MessageCodec::encode(msg, MessageCodec::BinaryFormat).size();
+	// close enough to account for queue limits
+	REQUIRE(estimate >= actual / 2);
+	REQUIRE(estimate <= actual * 2);
+	// the exact size once it is known
+	REQUIRE(MessageCodec::estimateSize(msg, MessageCodec::BinaryFormat) == actual);
+}
@@ -5,6 +5,8 @@
 #include "Message.h"
 #include "AbstractActor.h"
 
+#include <stdexcept>
+
 #include "DummyActor.h"
 
 TEST_CASE("actors register and unregister", "[MessageHub][AbstractActor]") {
@@ -73,6 +75,7 @@ TEST_CASE("messages are routed", "[MessageHub][AbstractActor]") {
 	DummyActor a2{&hub};
 	DummyActor a3{&hub};
 	DummyActor a4{&hub};
+	DummyActor a5{&hub};
 
 	a1.subscribeTo("a");
 	a2.subscribeTo("a");
@@ -80,6 +83,8 @@ TEST_CASE("messages are routed", "[MessageHub][AbstractActor]") {
 	a3.subscribeTo("a");
 	a3.subscribeTo("b");
 	a4.subscribeTo("*");
+	a5.subscribeTo("*");
+	a5.subscribeTo("a");
 
 	a1.send(Message("a", "test1"));
 	a2.send(Message("a", "test2"));
@@ -89,6 +94,94 @@ TEST_CASE("messages are routed", "[MessageHub][AbstractActor]") {
 	REQUIRE(a2.messages() == QVector<Message>({Message("a", "test1")}));
 	REQUIRE(a3.messages() == QVector<Message>({Message("a", "test1"), Message("a", "test2"), Message("b", "test3")}));
 	REQUIRE(a3.messages() == QVector<Message>({Message("a", "test1"), Message("a", "test2"), Message("b", "test3")}));
+	REQUIRE(a4.messages() == QVector<Message>({Message("a", "test1"), Message("a", "test2"), Message("b", "test3")}));
+	// once, even though it is subscribed to the channel and to everything
+	REQUIRE(a5.messages() == QVector<Message>({Message("a", "test1"), Message("a", "test2"), Message("b", "test3")}));
+}
+
+TEST_CASE("batches are delivered per actor", "[MessageHub][AbstractActor]") {
+	MessageHub hub;
+	DummyActor a1{&hub};
+	DummyActor a2{&hub};
+	DummyActor a3{&hub};
+
+	a1.subscribeTo("a");
+	a2.subscribeTo("a");
+	a2.subscribeTo("b");
+	a3.subscribeTo("b");
+
+	a1.sendBatch(QVector<Message>() << Message("a", "test1") << Message("b", "test2") << Message("a", "test3"));
+	REQUIRE(a1.messages().isEmpty());
+	REQUIRE(a2.messages() == QVector<Message>({Message("a", "test1"), Message("b", "test2"), Message("a", "test3")}));
+	REQUIRE(a2.batches() == QVector<int>({3}));
+	// a single message is delivered with receive()
+	REQUIRE(a3.messages() == QVector<Message>({Message("b", "test2")}));
+	REQUIRE(a3.batches().isEmpty());
+}
+
+class ReplyingActor : public DummyActor
+{
+public:
+	explicit ReplyingActor(MessageHub *hub, DummyActor *observed) : DummyActor(hub), m_observed(observed) {}
+
+	/// how many messages the observed actor had when we were receiving
+	QVector<int> observedCounts() const { return m_observedCounts; }
+
+private:
+	void receive(const Message &msg) override
+	{
+		m_observedCounts.append(m_observed->messages().size());
+		if (msg.command() == "request") {
+			send(msg.createReply("reply"));
+			send(msg.createReply("reply"));
+		}
+	}
+	DummyActor *m_observed;
+	QVector<int> m_observedCounts;
+};
+
+TEST_CASE("queued dispatch", "[MessageHub][AbstractActor]") {
+	MessageHub hub;
+	hub.setDispatchMode(MessageHub::QueuedDispatch);
+	DummyActor a1{&hub};
+	ReplyingActor a2{&hub, &a1};
+	a1.subscribeTo("a");
+	a2.subscribeTo("a");
+
+	a1.send(Message("a", "request"));
+	// the replies are delivered after receive has returned, as one batch
+	REQUIRE(a2.observedCounts() == QVector<int>({0}));
+	REQUIRE(a1.messages().size() == 2);
+	REQUIRE(a1.batches() == QVector<int>({2}));
+	REQUIRE(a1.messages().first().command() == "reply");
+}
+
+class ThrowingActor : public DummyActor
+{
+public:
+	using DummyActor::DummyActor;
+
+private:
+	void receive(const Message &msg) override
+	{
+		if (msg.command() == "throw") {
+			throw std::runtime_error("not handled by the hub");
+		}
+	}
+};
+
+TEST_CASE("queued dispatch recovers from exceptions", "[MessageHub][AbstractActor]") {
+	MessageHub hub;
+	hub.setDispatchMode(MessageHub::QueuedDispatch);
+	DummyActor a1{&hub};
+	ThrowingActor a2{&hub};
+	a1.subscribeTo("a");
+	a2.subscribeTo("a");
+
+	REQUIRE_THROWS_AS(a1.send(Message("a", "throw")), std::runtime_error);
+	REQUIRE_FALSE(hub.isDraining());
+	a2.send(Message("a", "test"));
+	REQUIRE(a1.messages().last().command() == "test");
 }
 
 TEST_CASE("resets are sent", "[MessageHub][AbstractActor]") {
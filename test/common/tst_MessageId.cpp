@@ -0,0 +1,36 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <QSet>
+
+#include "Message.h"
+#include "MessageIdGenerator.h"
+
+TEST_CASE("counting message ids", "[MessageIdGenerator]") {
+	CountingMessageIdGenerator generator;
+	QSet<QUuid> ids;
+	for (int i = 0; i < 10000; ++i) {
+		const QUuid id = generator.next();
+		REQUIRE(id.version() == QUuid::Random);
+		REQUIRE(id.variant() == QUuid::DCE);
+		ids.insert(id);
+	}
+	REQUIRE(ids.size() == 10000);
+
+	// separate generators (i.e. processes) use separate prefixes
+	CountingMessageIdGenerator other;
+	REQUIRE_FALSE(ids.contains(other.next()));
+}
+
+TEST_CASE("replacing the message id generator", "[MessageIdGenerator]") {
+	class FixedGenerator : public MessageIdGenerator
+	{
+	public:
+		QUuid next() override { return QUuid("{f9a7a0d2-3b53-4e4c-9d6e-0c1b8f2a4e11}"); }
+	} fixed;
+
+	MessageIdGenerator::setInstance(&fixed);
+	REQUIRE(Message("a", "b").id() == fixed.next());
+	MessageIdGenerator::setInstance(nullptr);
+	REQUIRE(Message("a", "b").id() != fixed.next());
+}
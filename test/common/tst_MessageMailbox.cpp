@@ -0,0 +1,82 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <QThread>
+#include <QHash>
+
+#include "MessageMailbox.h"
+
+TEST_CASE("mailbox order and wakeups", "[MessageMailbox]") {
+	int wakeups = 0;
+	MessageMailbox mailbox([&wakeups]() { ++wakeups; }, 4);
+
+	QVector<Message> sent;
+	for (int i = 0; i < 10; ++i) {
+		sent.append(Message("a", "test", i));
+		mailbox.push(sent.last());
+	}
+	REQUIRE(wakeups == 1);
+
+	QVector<Message> received;
+	mailbox.takeAll(&received);
+	REQUIRE(received.size() == 10);
+	for (int i = 0; i < 10; ++i) {
+		REQUIRE(received.at(i).id() == sent.at(i).id());
+	}
+
+	received.clear();
+	mailbox.takeAll(&received);
+	REQUIRE(received.isEmpty());
+
+	mailbox.push(Message("a", "test"));
+	REQUIRE(wakeups == 2);
+}
+
+class ProducerThread : public QThread
+{
+public:
+	explicit ProducerThread(MessageMailbox *mailbox, const int producer, const int count)
+		: m_mailbox(mailbox), m_producer(producer), m_count(count) {}
+
+protected:
+	void run() override
+	{
+		for (int i = 0; i < m_count; ++i) {
+			m_mailbox->push(Message(QString::number(m_producer), "test", i));
+		}
+	}
+
+private:
+	MessageMailbox *m_mailbox;
+	int m_producer;
+	int m_count;
+};
+
+TEST_CASE("mailbox with concurrent producers", "[MessageMailbox]") {
+	const int producers = 4;
+	const int perProducer = 10000;
+	MessageMailbox mailbox([]() {}, 64);
+
+	QVector<QThread *> threads;
+	for (int p = 0; p < producers; ++p) {
+		threads.append(new ProducerThread(&mailbox, p, perProducer));
+		threads.last()->start();
+	}
+
+	QHash<QString, int> next;
+	int total = 0;
+	while (total < producers * perProducer) {
+		QVector<Message> batch;
+		mailbox.takeAll(&batch);
+		for (const Message &msg : batch) {
+			// messages from each producer arrive in order
+			REQUIRE(msg.data().toInt() == next[msg.channel()]++);
+		}
+		total += batch.size();
+	}
+
+	for (QThread *thread : threads) {
+		thread->wait();
+		delete thread;
+	}
+}
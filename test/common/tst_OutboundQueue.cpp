@@ -0,0 +1,148 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include "OutboundQueue.h"
+#include "CRUDMessages.h"
+#include "StringDelta.h"
+
+TEST_CASE("outbound queue limits", "[OutboundQueue]") {
+	OutboundQueue::Metrics metrics;
+	OutboundQueue::Limits limits;
+	limits.maxMessages = 3;
+	limits.maxBytes = 100;
+
+	SECTION("drop oldest") {
+		OutboundQueue queue(limits, &metrics);
+		QVector<Message> sent;
+		for (int i = 0; i < 5; ++i) {
+			sent.append(Message("a", "test", i));
+			queue.enqueue(sent.last(), 10);
+		}
+		REQUIRE(queue.size() == 3);
+		REQUIRE(queue.isFull());
+		REQUIRE(queue.dropped() == 2);
+		REQUIRE(metrics.droppedMessages.load() == 2);
+		REQUIRE(metrics.queuedMessages.load() == 3);
+		REQUIRE(metrics.queuedBytes.load() == 30);
+		REQUIRE(queue.dequeue().id() == sent.at(2).id());
+
+		// a large message pushes out everything before it, but is kept itself
+		REQUIRE(queue.enqueue(Message("a", "test", 5), 200) == 2);
+		REQUIRE(queue.size() == 1);
+		REQUIRE(queue.bytes() == 200);
+	}
+	SECTION("other policies report being full") {
+		limits.policy = OutboundQueue::Disconnect;
+		OutboundQueue queue(limits, &metrics);
+		for (int i = 0; i < 3; ++i) {
+			REQUIRE(queue.enqueue(Message("a", "test", i), 10) == 0);
+		}
+		REQUIRE(queue.size() == 3);
+		REQUIRE(queue.isFull());
+		REQUIRE(queue.peakSize() == 3);
+		while (queue.size() > 1) {
+			queue.dequeue();
+		}
+		REQUIRE(queue.isBelowLowWater());
+	}
+	SECTION("blocking keeps everything up to the hard limit") {
+		limits.policy = OutboundQueue::Block;
+		limits.hardMaxBytes = 200;
+		OutboundQueue queue(limits, &metrics);
+		int dropped = 0;
+		for (int i = 0; i < 20; ++i) {
+			dropped += queue.enqueue(Message("a", "test", i), 10);
+		}
+		REQUIRE(dropped == 0);
+		REQUIRE(queue.size() == 20);
+		REQUIRE(queue.isFull());
+		REQUIRE(queue.enqueue(Message("a", "test", 20), 10) == 1);
+		REQUIRE(queue.bytes() == 200);
+	}
+	SECTION("the other policies stay within the limits") {
+		limits.maxMessages = 1000;
+		for (const OutboundQueue::Policy policy : {OutboundQueue::DropOldest, OutboundQueue::Disconnect}) {
+			limits.policy = policy;
+			OutboundQueue queue(limits, &metrics);
+			int dropped = 0;
+			for (int i = 0; i < 50; ++i) {
+				dropped += queue.enqueue(Message("a", "test", i), 30);
+				REQUIRE(queue.bytes() <= limits.maxBytes);
+			}
+			REQUIRE(queue.size() == 3);
+			REQUIRE(queue.peakBytes() <= limits.maxBytes);
+			REQUIRE(dropped == 47);
+		}
+	}
+
+	// the metrics are kept in sync when queues go away
+	REQUIRE(metrics.queuedMessages.load() == 0);
+	REQUIRE(metrics.queuedBytes.load() == 0);
+}
+
+TEST_CASE("outbound queue conflation", "[OutboundQueue]") {
+	OutboundQueue queue;
+
+	const Message first = Message("list", "changed", QJsonObject({{"id", 1}, {"name", "a"}})).setConflationKey("1.name");
+	const Message other = Message("list", "changed", QJsonObject({{"id", 2}, {"name", "x"}})).setConflationKey("2.name");
+	const Message second = Message("list", "changed", QJsonObject({{"id", 1}, {"name", "b"}})).setConflationKey("1.name");
+	queue.enqueue(first, 10);
+	queue.enqueue(other, 10);
+	queue.enqueue(second, 12);
+	REQUIRE(queue.size() == 2);
+	REQUIRE(queue.bytes() == 22);
+	REQUIRE(queue.conflated() == 1);
+
+	SECTION("the latest value takes the place of the first") {
+		REQUIRE(queue.dequeue().id() == second.id());
+		REQUIRE(queue.dequeue().id() == other.id());
+	}
+	SECTION("sent messages are not replaced") {
+		queue.dequeue();
+		const Message third = Message("list", "changed", QJsonObject({{"id", 1}, {"name", "c"}})).setConflationKey("1.name");
+		queue.enqueue(third, 10);
+		REQUIRE(queue.size() == 2);
+		REQUIRE(queue.dequeue().id() == other.id());
+		REQUIRE(queue.dequeue().id() == third.id());
+	}
+	SECTION("unless told otherwise") {
+		queue.enqueue(Message("list", "changed", QJsonObject({{"id", 1}, {"name", "c"}})).setConflationKey("1.name"), 10, false);
+		REQUIRE(queue.size() == 3);
+	}
+}
+
+TEST_CASE("update replies are conflated by record and properties", "[OutboundQueue]") {
+	const QUuid id = QUuid::createUuid();
+	const UpdateMessage update("list", "table", QJsonObject({{"id", id.toString()}, {"name", "a"}}));
+	const UpdateMessage otherProperties("list", "table", QJsonObject({{"id", id.toString()}, {"age", 3}}));
+	const UpdateMessage otherRecord("list", "table", QJsonObject({{"id", QUuid::createUuid().toString()}, {"name", "a"}}));
+
+	const QString key = OutboundQueue::conflationKey(update.createSuccessReply());
+	REQUIRE_FALSE(key.isNull());
+	REQUIRE(OutboundQueue::conflationKey(update) == QString());
+	REQUIRE(OutboundQueue::conflationKey(otherProperties.createSuccessReply()) != key);
+	REQUIRE(OutboundQueue::conflationKey(otherRecord.createSuccessReply()) != key);
+	REQUIRE(OutboundQueue::conflationKey(UpdateMessage("list", "table", QJsonObject({{"id", id.toString()}, {"name", "b"}})).createSuccessReply()) == key);
+}
+
+TEST_CASE("updates with deltas are not conflated", "[OutboundQueue]") {
+	const QUuid id = QUuid::createUuid();
+	const QString first(2000, 'a');
+	const QString second = first + "b";
+	const QString third = second + "c";
+	const UpdateMessage full("list", "table", QJsonObject({{"id", id.toString()}, {"text", second}}));
+	const UpdateMessage delta("list", "table", StringDelta::createAll(QJsonObject({{"text", second}}), QJsonObject({{"id", id.toString()}, {"text", third}})));
+	REQUIRE(StringDelta::containsDelta(delta.items().at(0)));
+
+	REQUIRE_FALSE(OutboundQueue::conflationKey(full.createSuccessReply()).isNull());
+	REQUIRE(OutboundQueue::conflationKey(delta.createSuccessReply()).isNull());
+
+	// the delta needs the update before it to be delivered
+	OutboundQueue queue;
+	queue.enqueue(full.createSuccessReply(), 10);
+	queue.enqueue(delta.createSuccessReply(), 10);
+	REQUIRE(queue.size() == 2);
+	REQUIRE(queue.conflated() == 0);
+	const QJsonObject base = queue.dequeue().toUpdateReply().items().at(0);
+	REQUIRE(StringDelta::resolve(base, queue.dequeue().toUpdateReply().items().at(0)).value("text") == third);
+}
@@ -0,0 +1,126 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <QHash>
+#include <QUuid>
+#include <QVariantHash>
+
+#include "jd-sync/client/lists/AbstractRecordList.h"
+#include "jd-sync/client/lists/RecordListModel.h"
+
+/// rows are changed directly, the signals are emitted by the test
+class FakeRecordList : public AbstractRecordList
+{
+public:
+	explicit FakeRecordList() : AbstractRecordList(nullptr) {}
+	ABSTRACTRECORDLIST_USING_COMFORT_OVERLOADS
+
+	QVariantHash get(const QUuid &id) const override { return m_rows.value(id); }
+	void set(const QVector<QVariantHash> &) override {}
+	void add(const QVector<QVariantHash> &) override {}
+	void remove(const QSet<QUuid> &) override {}
+	bool contains(const QUuid &id) const override { return m_rows.contains(id); }
+	QList<QUuid> ids() const override { return m_rows.keys(); }
+
+	QHash<QUuid, QVariantHash> m_rows;
+};
+
+struct ModelEvents
+{
+	/// first and last row of each rowsInserted/rowsRemoved
+	QVector<QPair<int, int>> inserted;
+	QVector<QPair<int, int>> removed;
+	/// top left and bottom right of each dataChanged
+	QVector<QPair<QModelIndex, QModelIndex>> changed;
+
+	void clear()
+	{
+		inserted.clear();
+		removed.clear();
+		changed.clear();
+	}
+};
+
+TEST_CASE("record list models", "[RecordListModel]") {
+	FakeRecordList list;
+	RecordListModel model(&list);
+	model.addMapping(0, "name");
+	model.addMapping(1, "value");
+
+	ModelEvents events;
+	QObject::connect(&model, &RecordListModel::rowsInserted, [&events](const QModelIndex &, int first, int last) { events.inserted.append(qMakePair(first, last)); });
+	QObject::connect(&model, &RecordListModel::rowsRemoved, [&events](const QModelIndex &, int first, int last) { events.removed.append(qMakePair(first, last)); });
+	QObject::connect(&model, &RecordListModel::dataChanged, [&events](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+		events.changed.append(qMakePair(topLeft, bottomRight));
+	});
+
+	const QUuid first = QUuid::createUuid();
+	list.m_rows.insert(first, QVariantHash({{"name", "a"}, {"value", 1}}));
+	emit list.added(first);
+	REQUIRE(events.inserted == QVector<QPair<int, int>>({qMakePair(0, 0)}));
+	REQUIRE(model.rowCount(QModelIndex()) == 1);
+	events.clear();
+
+	SECTION("outside of batches every signal is forwarded") {
+		emit list.changed(first, "name");
+		emit list.changed(first, "value");
+		REQUIRE(events.changed.size() == 2);
+	}
+	SECTION("batches insert and change once at the end") {
+		const QUuid second = QUuid::createUuid();
+		const QUuid third = QUuid::createUuid();
+		list.m_rows.insert(second, QVariantHash({{"name", "b"}}));
+		list.m_rows.insert(third, QVariantHash({{"name", "c"}}));
+
+		emit list.batchStarted();
+		emit list.added(second);
+		emit list.added(third);
+		emit list.changed(first, "name");
+		emit list.changed(first, "value");
+		REQUIRE(events.inserted.isEmpty());
+		REQUIRE(events.changed.isEmpty());
+		REQUIRE(model.rowCount(QModelIndex()) == 1);
+
+		emit list.batchFinished();
+		REQUIRE(events.inserted == QVector<QPair<int, int>>({qMakePair(1, 2)}));
+		REQUIRE(events.changed.size() == 1);
+		REQUIRE(events.changed.first().first == model.index(0, 0));
+		REQUIRE(events.changed.first().second == model.index(0, 1));
+		REQUIRE(model.rowCount(QModelIndex()) == 3);
+		REQUIRE(model.data(model.index(2, 0), Qt::DisplayRole) == QVariant("c"));
+	}
+	SECTION("nested batches end with the outermost") {
+		emit list.batchStarted();
+		emit list.batchStarted();
+		emit list.changed(first, "name");
+		emit list.batchFinished();
+		REQUIRE(events.changed.isEmpty());
+		emit list.batchFinished();
+		REQUIRE(events.changed.size() == 1);
+	}
+	SECTION("removals within batches") {
+		const QUuid second = QUuid::createUuid();
+		const QUuid pending = QUuid::createUuid();
+		list.m_rows.insert(second, QVariantHash({{"name", "b"}}));
+		emit list.added(second);
+		events.clear();
+
+		emit list.batchStarted();
+		emit list.added(pending);
+		emit list.changed(second, "name");
+		// never shown, so there is nothing to remove
+		emit list.removed(pending);
+		REQUIRE(events.removed.isEmpty());
+		// changes are announced before the rows move
+		emit list.removed(first);
+		REQUIRE(events.changed.size() == 1);
+		REQUIRE(events.changed.first().first.row() == 1);
+		REQUIRE(events.removed == QVector<QPair<int, int>>({qMakePair(0, 0)}));
+
+		emit list.batchFinished();
+		REQUIRE(events.inserted.isEmpty());
+		REQUIRE(events.changed.size() == 1);
+		REQUIRE(model.rowCount(QModelIndex()) == 1);
+		REQUIRE(model.idForIndex(model.index(0, 0)) == second);
+	}
+}
@@ -1,10 +1,52 @@
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 
+#include <QCoreApplication>
+#include <QTimer>
+
 #include "Request.h"
 #include "MessageHub.h"
+#include "CRUDMessages.h"
+#include "IndexReplyStream.h"
+#include "AbstractExternalActor.h"
+#include "Atom.h"
 
 #include "DummyActor.h"
+#include "WaitFor.h"
+
+/// connects two hubs in the same process, like a TCP connection would
+class LoopbackActor : public AbstractExternalActor
+{
+public:
+	explicit LoopbackActor(MessageHub *hub, const bool followRemoteInterest)
+		: AbstractExternalActor(hub), m_follow(followRemoteInterest)
+	{
+	}
+
+	/// connects to the peer, on the actor thread
+	void setPeer(LoopbackActor *peer)
+	{
+		m_peer = peer;
+		QTimer::singleShot(0, this, [this]() {
+			if (m_follow) {
+				setFollowRemoteInterest(true);
+			} else {
+				subscribeTo("*");
+			}
+			announceInterest();
+		});
+	}
+
+private:
+	void sendToExternal(const Message &message) override
+	{
+		LoopbackActor *peer = m_peer;
+		QTimer::singleShot(0, peer, [peer, message]() { peer->receivedFromExternal(message); });
+	}
+
+	LoopbackActor *m_peer = nullptr;
+	const bool m_follow;
+};
 
 TEST_CASE("request", "[Request]") {
 	MessageHub hub;
@@ -31,4 +73,125 @@ TEST_CASE("request", "[Request]") {
 		REQUIRE(received.isNull());
 		REQUIRE(error == Message("simple", "error", QJsonObject({{"msg", "foobar"}})));
 	}
+
+	SECTION("replies are routed directly") {
+		DummyActor actor{&hub};
+		actor.subscribeTo("simple");
+		DummyActor listener{&hub};
+		listener.subscribeTo("simple");
+
+		int received1 = 0, received2 = 0;
+		Request request1{&hub, Message("simple", "test1")};
+		request1.then([&received1](const Message &) { ++received1; }).send();
+		Request request2{&hub, Message("simple", "test2")};
+		request2.then([&received2](const Message &) { ++received2; }).send();
+		REQUIRE(hub.actors().size() == 4);
+
+		actor.send(actor.messages().at(1).createReply("result", QJsonValue()));
+		REQUIRE(received1 == 0);
+		REQUIRE(received2 == 1);
+		// other subscribers still see the reply
+		REQUIRE(listener.messages().last().command() == "result");
+
+		actor.send(actor.messages().at(0).createReply("result", QJsonValue()));
+		REQUIRE(received1 == 1);
+		REQUIRE(received2 == 1);
+	}
+
+	SECTION("resending forgets the previous attempt") {
+		DummyActor actor{&hub};
+		actor.subscribeTo("resent");
+
+		int received = 0;
+		Request request{&hub, Message("resent", "question")};
+		request.then([&received](const Message &) { ++received; }).send();
+		REQUIRE(hub.channels().contains(Atom::intern("resent")));
+		actor.send(Message("client", "reset"));
+		REQUIRE(actor.messages().size() == 2);
+		REQUIRE(actor.messages().at(0).id() != actor.messages().at(1).id());
+
+		actor.send(actor.messages().at(1).createReply("answer", QJsonValue()));
+		REQUIRE(received == 1);
+		// the first attempt does not keep the channel alive
+		actor.unsubscribeFrom("resent");
+		REQUIRE_FALSE(hub.channels().contains(Atom::intern("resent")));
+	}
+
+	SECTION("streamed index replies") {
+		DummyActor server{&hub};
+		server.subscribeTo("list");
+		DummyActor client{&hub};
+
+		QVector<Message> chunks;
+		Request request{&hub, IndexMessage("list", "list").setChunkSize(2, 1)};
+		request.then([&chunks](const Message &msg) { chunks.append(msg); }).send();
+		REQUIRE(server.messages().size() == 1);
+
+		QJsonArray items;
+		for (int i = 0; i < 5; ++i) {
+			items.append(QJsonObject({{"id", i}}));
+		}
+		IndexReplyStream::send(&hub, server.messages().first().toIndex(), items);
+		// only as much as the credit allows
+		REQUIRE(chunks.size() == 1);
+		REQUIRE_FALSE(chunks.first().toIndexReply().isFinal());
+
+		client.send(chunks.first().toIndexReply().createCredit(5));
+		REQUIRE(chunks.size() == 4);
+		// only the stream gets the credit, and only the requester the chunks
+		REQUIRE(server.messages().size() == 1);
+		int rows = 0;
+		for (const Message &chunk : chunks) {
+			rows += chunk.toIndexReply().items().size();
+		}
+		REQUIRE(rows == 5);
+		REQUIRE(chunks.last().toIndexReply().isFinal());
+	}
+
+	SECTION("request objects get every chunk") {
+		DummyActor server{&hub};
+		server.subscribeTo("list");
+
+		RequestObject *object = new RequestObject(&hub, IndexMessage("list", "list").setChunkSize(2, 5));
+		int replies = 0, finished = 0;
+		QObject::connect(object, &RequestObject::reply, [&replies]() { ++replies; });
+		QObject::connect(object, &RequestObject::finished, [&finished]() { ++finished; });
+		object->send();
+
+		QJsonArray items;
+		for (int i = 0; i < 5; ++i) {
+			items.append(QJsonObject({{"id", i}}));
+		}
+		IndexReplyStream::send(&hub, server.messages().first().toIndex(), items);
+		REQUIRE(replies == 4);
+		REQUIRE(finished == 1);
+	}
+}
+
+TEST_CASE("requests through an external actor", "[Request]") {
+	int argc = 0;
+	QCoreApplication app(argc, nullptr);
+
+	MessageHub serverHub;
+	MessageHub clientHub;
+	DummyActor service{&serverHub};
+	service.subscribeTo("custom");
+
+	LoopbackActor server{&serverHub, true};
+	LoopbackActor client{&clientHub, false};
+	server.setPeer(&client);
+	client.setPeer(&server);
+
+	// nothing on the client side is subscribed to the channel, the pending request is what brings the reply back
+	Message received;
+	Request request{&clientHub, Message("custom", "question")};
+	request.then([&received](const Message &msg) { received = msg; }).send();
+	REQUIRE(clientHub.channels().contains(Atom::intern("custom")));
+
+	REQUIRE(waitFor([&service]() { return !service.messages().isEmpty(); }));
+	service.send(service.messages().first().createReply("answer", QJsonValue()));
+	REQUIRE(waitFor([&received]() { return !received.isNull(); }));
+	REQUIRE(received.command() == "answer");
+	// the interest goes away with the last pending reply
+	REQUIRE_FALSE(clientHub.channels().contains(Atom::intern("custom")));
 }
@@ -0,0 +1,102 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <QCoreApplication>
+
+#include "MessageHub.h"
+#include "jd-sync/server/tcp/TcpServer.h"
+#include "jd-sync/client/TcpClientActor.h"
+
+#include "DummyActor.h"
+#include "WaitFor.h"
+
+TEST_CASE("connections on reactor threads", "[TcpServer]") {
+	int argc = 0;
+	QCoreApplication app(argc, nullptr);
+
+	MessageHub serverHub;
+	DummyActor service{&serverHub};
+	service.subscribeTo("custom");
+	TcpServer server{&serverHub, QHostAddress::LocalHost, 0};
+	server.setReactorThreads(2, false);
+	server.start();
+	REQUIRE(server.port() != 0);
+
+	MessageHub clientHub;
+	DummyActor sender{&clientHub};
+	sender.subscribeTo("custom");
+	TcpClientActor client{&clientHub, "127.0.0.1", server.port()};
+	bool connected = false;
+	QObject::connect(&client, &TcpClientActor::connected, &app, [&connected]() { connected = true; });
+	QMetaObject::invokeMethod(&client, "connectToHost", Qt::QueuedConnection);
+	REQUIRE(waitFor([&connected]() { return connected; }));
+
+	sender.send(Message("custom", "hello"));
+	REQUIRE(waitFor([&service]() { return !service.messages().isEmpty(); }));
+	REQUIRE(service.messages().last().command() == "hello");
+}
+
+static QVector<int> numbers(const DummyActor &actor)
+{
+	QVector<int> out;
+	for (const Message &msg : actor.messages()) {
+		if (msg.command() == "number") {
+			out.append(msg.data().toInt());
+		}
+	}
+	return out;
+}
+
+/// sends numbers to the client while it reconnects, with authentication if token is not null
+static void resumeSession(const QString &token)
+{
+	int argc = 0;
+	QCoreApplication app(argc, nullptr);
+
+	MessageHub serverHub;
+	DummyActor service{&serverHub};
+	service.subscribeTo("custom");
+	TcpServer server{&serverHub, QHostAddress::LocalHost, 0};
+	server.setSessionResumption(30 * 1000);
+	if (!token.isNull()) {
+		server.setAuthentication(token);
+	}
+	server.start();
+
+	MessageHub clientHub;
+	DummyActor receiver{&clientHub};
+	receiver.subscribeTo("custom");
+	TcpClientActor client{&clientHub, "127.0.0.1", server.port()};
+	if (!token.isNull()) {
+		QMetaObject::invokeMethod(&client, "setAuthentication", Qt::QueuedConnection, Q_ARG(QString, token));
+	}
+	QMetaObject::invokeMethod(&client, "connectToHost", Qt::QueuedConnection);
+
+	// nothing reaches the client before it has announced its interest
+	REQUIRE(waitFor([&service, &receiver]() {
+		service.send(Message("custom", "ready"));
+		return !receiver.messages().isEmpty();
+	}));
+
+	for (int i = 0; i < 3; ++i) {
+		service.send(Message("custom", "number", i));
+	}
+	REQUIRE(waitFor([&receiver]() { return numbers(receiver).size() == 3; }));
+
+	// the client reconnects right away, what is sent meanwhile is either buffered or replayed
+	QMetaObject::invokeMethod(&client, "disconnectFromHost", Qt::QueuedConnection);
+	for (int i = 3; i < 6; ++i) {
+		service.send(Message("custom", "number", i));
+	}
+	REQUIRE(waitFor([&receiver]() { return numbers(receiver).size() >= 6; }));
+	// give duplicates a chance to show up
+	waitFor([]() { return false; }, 200);
+	REQUIRE(numbers(receiver) == QVector<int>({0, 1, 2, 3, 4, 5}));
+}
+
+TEST_CASE("resumed sessions", "[TcpServer]") {
+	resumeSession(QString());
+}
+TEST_CASE("resumed sessions are authenticated again", "[TcpServer]") {
+	resumeSession(QStringLiteral("secret"));
+}
@@ -0,0 +1,121 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <QBuffer>
+#include <QtEndian>
+
+#include <jd-util/Exception.h>
+
+#include "TcpUtils.h"
+
+static QByteArray frame(const QByteArray &data)
+{
+	uchar size[4];
+	qToLittleEndian<quint32>(quint32(data.size()), size);
+	return QByteArray(reinterpret_cast<const char *>(size), 4) + data;
+}
+
+TEST_CASE("incremental frame reading", "[TcpUtils]") {
+	const QByteArray stream = frame("first") + frame(QByteArray()) + frame("third frame");
+
+	QBuffer buffer;
+	buffer.open(QBuffer::ReadWrite);
+	TcpUtils::FrameReader reader;
+	QVector<QByteArray> frames;
+	QByteArray out;
+
+	// feed the stream in small pieces, frames come out as soon as they are complete
+	for (int i = 0; i < stream.size(); i += 3) {
+		const qint64 pos = buffer.pos();
+		buffer.seek(buffer.size());
+		buffer.write(stream.mid(i, 3));
+		buffer.seek(pos);
+
+		reader.readFrom(&buffer);
+		while (reader.next(&out)) {
+			frames.append(QByteArray(out.constData(), out.size()));
+		}
+	}
+	REQUIRE(frames == QVector<QByteArray>({"first", QByteArray(), "third frame"}));
+}
+
+TEST_CASE("frame size limit", "[TcpUtils]") {
+	QBuffer buffer;
+	buffer.setData(frame(QByteArray(100, 'x')));
+	buffer.open(QBuffer::ReadOnly);
+
+	TcpUtils::FrameReader reader(50);
+	reader.readFrom(&buffer);
+	QByteArray out;
+	REQUIRE_THROWS_AS(reader.next(&out), Exception);
+}
+
+TEST_CASE("handing unconsumed data to another reader", "[TcpUtils]") {
+	QBuffer buffer;
+	buffer.setData(frame("first") + frame("second") + frame("third").left(6));
+	buffer.open(QBuffer::ReadOnly);
+
+	TcpUtils::FrameReader reader;
+	reader.readFrom(&buffer);
+	QByteArray out;
+	REQUIRE(reader.next(&out));
+	REQUIRE(out == "first");
+
+	TcpUtils::FrameReader other;
+	other.append(reader.takeBuffered());
+	REQUIRE_FALSE(reader.next(&out));
+	REQUIRE(other.next(&out));
+	REQUIRE(out == "second");
+	REQUIRE_FALSE(other.next(&out));
+	other.append(frame("third").mid(6));
+	REQUIRE(other.next(&out));
+	REQUIRE(out == "third");
+}
+
+TEST_CASE("coalesced frame writing", "[TcpUtils]") {
+	QBuffer buffer;
+	buffer.open(QBuffer::ReadWrite);
+
+	TcpUtils::FrameWriter writer(&buffer);
+	writer.write("first");
+	writer.write("second");
+	REQUIRE(buffer.data().isEmpty());
+	writer.flush();
+	REQUIRE(buffer.data() == frame("first") + frame("second"));
+
+	// reaching the threshold flushes right away
+	writer.setFlushThreshold(10);
+	writer.write("a longer frame");
+	REQUIRE(writer.bufferedBytes() == 0);
+	REQUIRE(buffer.data() == frame("first") + frame("second") + frame("a longer frame"));
+}
+
+TEST_CASE("compressed frames", "[TcpUtils]") {
+	QBuffer buffer;
+	buffer.open(QBuffer::ReadWrite);
+
+	const QByteArray large = QByteArray("{\"id\":\"0f1e2d3c\",\"name\":\"something\"}").repeated(100);
+	TcpUtils::FrameWriter writer(&buffer);
+	writer.setCompressionThreshold(64);
+	writer.write("small");
+	writer.write(large);
+	writer.flush();
+	REQUIRE(buffer.data().size() < large.size());
+
+	buffer.seek(0);
+	TcpUtils::FrameReader reader;
+	reader.readFrom(&buffer);
+	QByteArray out;
+	REQUIRE(reader.next(&out));
+	REQUIRE(out == "small");
+	REQUIRE(reader.next(&out));
+	REQUIRE(out == large);
+
+	SECTION("the uncompressed size counts towards the limit") {
+		buffer.seek(0);
+		TcpUtils::FrameReader limited(1024);
+		limited.readFrom(&buffer);
+		REQUIRE(limited.next(&out));
+		REQUIRE_THROWS_AS(limited.next(&out), Exception);
+	}
+}
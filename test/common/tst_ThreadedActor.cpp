@@ -1,2 +1,86 @@
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
+
+#include <QAtomicPointer>
+#include <algorithm>
+
+#include "ActorScheduler.h"
+#include "AbstractThreadedActor.h"
+#include "MessageHub.h"
+
+#include "DummyActor.h"
+#include "WaitFor.h"
+
+TEST_CASE("actor scheduler placement", "[ThreadedActor][ActorScheduler]") {
+	ActorScheduler scheduler(2);
+	REQUIRE(scheduler.threadCount() == 2);
+
+	QThread *first = scheduler.acquire();
+	QThread *second = scheduler.acquire();
+	REQUIRE(first != second);
+	REQUIRE(scheduler.acquire() == first);
+
+	// the thread with the fewest actors gets the next one
+	scheduler.release(first);
+	scheduler.release(first);
+	REQUIRE(scheduler.acquire() == first);
+	scheduler.release(second);
+	REQUIRE(scheduler.acquire() == second);
+	// ties go to the first thread
+	REQUIRE(scheduler.acquire() == first);
+}
+
+/// replies to pings, remembering the thread it did so on
+class EchoActor : public AbstractThreadedActor
+{
+public:
+	explicit EchoActor(MessageHub *hub, ActorScheduler *scheduler)
+		: AbstractThreadedActor(hub, nullptr, scheduler) {}
+
+	QThread *receivedOn() const { return m_receivedOn.loadAcquire(); }
+
+protected:
+	void run() override
+	{
+		subscribeTo("echo");
+		AbstractThreadedActor::run();
+	}
+	void received(const Message &msg) override
+	{
+		if (msg.command() == "ping") {
+			m_receivedOn.storeRelease(QThread::currentThread());
+			send(msg.createReply("pong", msg.data()));
+		}
+	}
+
+private:
+	QAtomicPointer<QThread> m_receivedOn;
+};
+
+TEST_CASE("actors run on the threads of their scheduler", "[ThreadedActor][ActorScheduler]") {
+	int argc = 0;
+	QCoreApplication app(argc, nullptr);
+
+	ActorScheduler scheduler(2);
+	MessageHub hub;
+	DummyActor client{&hub};
+	client.subscribeTo("echo");
+	EchoActor first{&hub, &scheduler};
+	EchoActor second{&hub, &scheduler};
+
+	// the actors subscribe once they run, until then pings go nowhere
+	REQUIRE(waitFor([&]() {
+		client.send(Message("echo", "ping"));
+		return first.receivedOn() && second.receivedOn();
+	}));
+	REQUIRE(waitFor([&client]() {
+		const QVector<Message> messages = client.messages();
+		return std::any_of(messages.cbegin(), messages.cend(), [](const Message &msg) { return msg.command() == "pong"; });
+	}));
+	REQUIRE(first.receivedOn() != QThread::currentThread());
+	REQUIRE(second.receivedOn() != QThread::currentThread());
+	// placed on different workers of the pool
+	REQUIRE(first.receivedOn() != second.receivedOn());
+	REQUIRE((first.receivedOn() == scheduler.thread(0) || first.receivedOn() == scheduler.thread(1)));
+	REQUIRE((second.receivedOn() == scheduler.thread(0) || second.receivedOn() == scheduler.thread(1)));
+}